@@ -53,12 +53,17 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (either 4 or 8, 16 for 64-bit builds) 
  */
+#if defined(__LP64__)
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8  
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes, unless set at run time by mdriver -m or
+ * the MEM_HEAP_SIZE environment variable
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
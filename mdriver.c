@@ -1,7 +1,7 @@
 /*
  * mdriver.c - CS:APP Malloc Lab Driver
  *
- * Uses a collection of trace files to tests a malloc/free/realloc
+ * Uses a collection of trace files to tests a malloc/free/realloc/calloc
  * implementation in mm.c.
  *
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
@@ -29,9 +29,10 @@
 #define MAXLINE 1024			 /* max string size */
 #define HDRLINES 4				 /* number of header lines in a trace file */
 #define LINENUM(i) (i + 5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAX_BATCH 256			 /* largest batch for -b */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p) ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p) ((((size_t)(p)) % ALIGNMENT) == 0)
 
 /******************************
  * The key compound data types
@@ -52,10 +53,13 @@ typedef struct
 	{
 		ALLOC,
 		FREE,
-		REALLOC
+		REALLOC,
+		CALLOC
 	} type;		 /* type of request */
 	int index; /* index for free() to use later */
-	int size;	 /* byte size of alloc/realloc request */
+	int size;	 /* byte size of alloc/realloc/calloc request */
+	char scoped;		/* the block was allocated inside a scope of b and e lines (-A) */
+	char scope_end; /* a scope ends after this request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -68,6 +72,7 @@ typedef struct
 	traceop_t *ops;			 /* array of requests */
 	char **blocks;			 /* array of ptrs returned by malloc/realloc... */
 	size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+	int num_scopes;			 /* scopes of b and e lines */
 } trace_t;
 
 /*
@@ -91,6 +96,8 @@ typedef struct
 
 	/* defined only for the student malloc package */
 	double util; /* space utilization for this trace (always 0 for libc) */
+	size_t peak_heap;  /* largest heap size plus mapped bytes while running the trace */
+	size_t final_heap; /* heap size plus mapped bytes after running the trace */
 
 	/* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -100,6 +107,12 @@ typedef struct
  *******************/
 int verbose = 0;			 /* global flag for verbose output */
 static int errors = 0; /* number of errs found when running student malloc */
+static int batch = 0;	 /* if > 1, replay runs of requests in batches of up to this many (-b) */
+static int check_every = 0; /* if > 0, run mm_checkheap after this many requests (-c) */
+static int check_level = 3; /* level of those checks (-c) */
+static int show_stats = 0;	/* if set, print mm_stats after the util pass of each trace (-s) */
+static int compare_order = 0; /* if set, run each trace again with address-ordered free lists (-o) */
+static int arena_mode = 0;		/* if set, also replay the scopes of each trace through a bump arena (-A) */
 char msg[MAXLINE];		 /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -133,8 +146,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* replay the scopes of a trace through an mm_arena bump allocator */
+static int eval_arena_valid(trace_t *trace, int tracenum, range_t **ranges, char **skipped);
+static void eval_arena_speed(void *ptr);
+
+/* Routines for replaying requests with the batch API (-b) */
+static int batch_len(trace_t *trace, int i);
+static int eval_mm_valid_batch(trace_t *trace, int tracenum, int i, int n,
+															 range_t **ranges);
+static void run_batch(trace_t *trace, int i, int n);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printorder(int n, stats_t *lifo, stats_t *ordered);
+static void printarena(int n, stats_t *plain, stats_t *arena, int *scopes, char **skipped);
+static void print_mm_stats(char *tracefile);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -153,9 +179,15 @@ int main(int argc, char **argv)
 	range_t *ranges = NULL;			/* keeps track of block extents for one trace */
 	stats_t *libc_stats = NULL; /* libc stats for each trace */
 	stats_t *mm_stats = NULL;		/* mm (i.e. student) stats for each trace */
+	stats_t *order_stats = NULL; /* mm stats with address-ordered free lists (-o) */
+	stats_t *arena_stats = NULL; /* mm_arena stats for each trace (-A) */
+	int *arena_scopes = NULL;		 /* scopes of each trace (-A) */
+	char **arena_skipped = NULL; /* why the arena run of each trace was skipped, or NULL (-A) */
 	speed_t speed_params;				/* input parameters to the xx_speed routines */
 
 	int run_libc = 0;		/* If set, run libc malloc (set by -l) */
+	int pages = MEM_PAGES_SMALL; /* pages backing the heap (set by -p) */
+	size_t heap_size = 0;		/* reserved heap size, 0 for the default (set by -m) */
 	int autograder = 0; /* If set, emit summary info for autograder (-g) */
 
 	/* temporaries used to compute the performance index */
@@ -165,7 +197,7 @@ int main(int argc, char **argv)
 	/*
 	 * Read and interpret the command line arguments
 	 */
-	while ((c = getopt(argc, argv, "f:t:hvVgl")) != EOF)
+	while ((c = getopt(argc, argv, "f:t:b:c:p:m:F:AoshvVgl")) != EOF)
 	{
 		switch (c)
 		{
@@ -187,6 +219,58 @@ int main(int argc, char **argv)
 			if (tracedir[strlen(tracedir) - 1] != '/')
 				strcat(tracedir, "/"); /* path always ends with "/" */
 			break;
+		case 'b': /* Use mm_malloc_batch and mm_free_batch */
+			batch = atoi(optarg);
+			if (batch < 1 || batch > MAX_BATCH)
+			{
+				fprintf(stderr, "Batch size must be between 1 and %d\n", MAX_BATCH);
+				exit(1);
+			}
+			break;
+		case 'c': /* Check the heap every n requests, optionally at a given level */
+			if (sscanf(optarg, "%d,%d", &check_every, &check_level) < 1 || check_every < 1 ||
+				check_level < 1 || check_level > 3)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'p': /* Pages backing the simulated heap */
+			if (strcmp(optarg, "small") == 0)
+				pages = MEM_PAGES_SMALL;
+			else if (strcmp(optarg, "thp") == 0)
+				pages = MEM_PAGES_THP;
+			else if (strcmp(optarg, "hugetlb") == 0)
+				pages = MEM_PAGES_HUGETLB;
+			else
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'm': /* Size reserved for the simulated heap */
+			if ((heap_size = mem_parse_size(optarg)) == 0)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'F': /* Placement policy of mm.c */
+			if (mm_set_fit(optarg) < 0)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'A': /* Compare bump arenas over request scopes with malloc/free */
+			arena_mode = 1;
+			break;
+		case 'o': /* Compare address-ordered free lists with LIFO ones */
+			compare_order = 1;
+			break;
+		case 's': /* Print allocator statistics */
+			show_stats = 1;
+			break;
 		case 'l': /* Run libc malloc */
 			run_libc = 1;
 			break;
@@ -268,9 +352,25 @@ int main(int argc, char **argv)
 	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
 	if (mm_stats == NULL)
 		unix_error("mm_stats calloc in main failed");
+	if (compare_order && (order_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t))) == NULL)
+		unix_error("order_stats calloc in main failed");
+	if (arena_mode && ((arena_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t))) == NULL ||
+										 (arena_scopes = (int *)calloc(num_tracefiles, sizeof(int))) == NULL ||
+										 (arena_skipped = (char **)calloc(num_tracefiles, sizeof(char *))) == NULL))
+		unix_error("arena_stats calloc in main failed");
 
 	/* Initialize the simulated memory system in memlib.c */
+	mem_set_pages(pages);
+	if (heap_size != 0)
+		mem_set_heap_size(heap_size);
 	mem_init();
+	if (verbose > 1)
+	{
+		static char *page_names[] = {"small", "transparent huge", "hugetlbfs"};
+		mem_region_t *heap = mem_default_region();
+		printf("Heap of %zu KB reserved, backed by %s pages\n",
+			   mem_region_maxsize(heap) / 1024, page_names[mem_region_pages(heap)]);
+	}
 
 	/* Evaluate student's mm malloc package using the K-best scheme */
 	for (i = 0; i < num_tracefiles; i++)
@@ -285,12 +385,49 @@ int main(int argc, char **argv)
 			if (verbose > 1)
 				printf("efficiency, ");
 			mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+			mm_stats[i].peak_heap = mem_peak_footprint();
+			mm_stats[i].final_heap = mem_footprint();
+			if (show_stats)
+				print_mm_stats(tracefiles[i]);
 			speed_params.trace = trace;
 			speed_params.ranges = ranges;
 			if (verbose > 1)
 				printf("and performance.\n");
 			mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
 		}
+		if (compare_order && mm_stats[i].valid)
+		{
+			if (verbose > 1)
+				printf("Repeating with address-ordered free lists.\n");
+			mm_set_ordered(1);
+			order_stats[i].ops = trace->num_ops;
+			order_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+			if (order_stats[i].valid)
+			{
+				order_stats[i].util = eval_mm_util(trace, i, &ranges);
+				speed_params.ranges = ranges;
+				order_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+			}
+			mm_set_ordered(0);
+		}
+		if (arena_mode && mm_stats[i].valid)
+		{
+			arena_scopes[i] = trace->num_scopes;
+			arena_stats[i].ops = trace->num_ops;
+			if (trace->num_scopes == 0)
+				arena_skipped[i] = "no b and e lines";
+			else
+			{
+				if (verbose > 1)
+					printf("Repeating with a bump arena per scope.\n");
+				arena_stats[i].valid = eval_arena_valid(trace, i, &ranges, &arena_skipped[i]);
+			}
+			if (arena_stats[i].valid)
+			{
+				speed_params.ranges = ranges;
+				arena_stats[i].secs = fsecs(eval_arena_speed, &speed_params);
+			}
+		}
 		free_trace(trace);
 	}
 
@@ -301,6 +438,18 @@ int main(int argc, char **argv)
 		printresults(num_tracefiles, mm_stats);
 		printf("\n");
 	}
+	if (compare_order)
+	{
+		printf("\nLIFO and address-ordered free lists:\n");
+		printorder(num_tracefiles, mm_stats, order_stats);
+		printf("\n");
+	}
+	if (arena_mode)
+	{
+		printf("\nmalloc/free and a bump arena reset per scope:\n");
+		printarena(num_tracefiles, mm_stats, arena_stats, arena_scopes, arena_skipped);
+		printf("\n");
+	}
 
 	/*
 	 * Accumulate the aggregate statistics for the student's mm package
@@ -388,9 +537,10 @@ static int add_range(range_t **ranges, char *lo, int size,
 		return 0;
 	}
 
-	/* The payload must lie within the extent of the heap */
-	if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-			(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))
+	/* The payload must lie within the extent of the heap, or of a direct mapping */
+	if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+			 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+			!mem_is_mapped(lo, hi))
 	{
 		sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 						lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -478,6 +628,9 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	unsigned index, size;
 	unsigned max_index = 0;
 	unsigned op_index;
+	int in_scope = 0;	 /* between a b and an e line */
+	int scoped_live = 0; /* blocks allocated in the current scope and not freed yet */
+	char *scoped_id;		 /* scoped_id[id] is set while block id is one of them */
 
 	if (verbose > 1)
 		printf("Reading tracefile: %s\n", filename);
@@ -513,6 +666,9 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	if ((trace->block_sizes =
 					 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 		unix_error("malloc 4 failed in read_trace");
+	if ((scoped_id = (char *)calloc(trace->num_ids, 1)) == NULL)
+		unix_error("calloc 5 failed in read_trace");
+	trace->num_scopes = 0;
 
 	/* read every request line in the trace file */
 	index = 0;
@@ -535,19 +691,69 @@ static trace_t *read_trace(char *tracedir, char *filename)
 			trace->ops[op_index].size = size;
 			max_index = (index > max_index) ? index : max_index;
 			break;
+		case 'c':
+			fscanf(tracefile, "%u %u", &index, &size);
+			trace->ops[op_index].type = CALLOC;
+			trace->ops[op_index].index = index;
+			trace->ops[op_index].size = size;
+			max_index = (index > max_index) ? index : max_index;
+			break;
 		case 'f':
 			fscanf(tracefile, "%ud", &index);
 			trace->ops[op_index].type = FREE;
 			trace->ops[op_index].index = index;
 			break;
+		case 'b': /* begin a scope: the blocks allocated in it die together by its e line */
+			if (in_scope)
+			{
+				printf("Nested scope in tracefile %s\n", path);
+				exit(1);
+			}
+			in_scope = 1;
+			trace->num_scopes++;
+			continue;
+		case 'e': /* end a scope */
+			if (!in_scope || scoped_live != 0)
+			{
+				printf("Scope ends %s in tracefile %s\n", in_scope ? "with live blocks" : "unopened", path);
+				exit(1);
+			}
+			in_scope = 0;
+			if (op_index > 0)
+				trace->ops[op_index - 1].scope_end = 1;
+			continue;
 		default:
 			printf("Bogus type character (%c) in tracefile %s\n",
 						 type[0], path);
 			exit(1);
 		}
+		/* A block stays scoped from its allocation to its free */
+		index = trace->ops[op_index].index;
+		trace->ops[op_index].scope_end = 0;
+		if (trace->ops[op_index].type == ALLOC || trace->ops[op_index].type == CALLOC)
+		{
+			trace->ops[op_index].scoped = in_scope;
+			scoped_id[index] = in_scope;
+			scoped_live += in_scope;
+		}
+		else
+		{
+			trace->ops[op_index].scoped = scoped_id[index];
+			if (trace->ops[op_index].type == FREE && scoped_id[index])
+			{
+				scoped_id[index] = 0;
+				scoped_live--;
+			}
+		}
 		op_index++;
 	}
 	fclose(tracefile);
+	free(scoped_id);
+	if (in_scope)
+	{
+		printf("Unterminated scope in tracefile %s\n", path);
+		exit(1);
+	}
 	assert(max_index == trace->num_ids - 1);
 	assert(trace->num_ops == op_index);
 
@@ -576,10 +782,11 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 {
-	int i, j;
+	int i, j, n;
 	int index;
 	int size;
 	int oldsize;
+	int next_check;
 	char *newp;
 	char *oldp;
 	char *p;
@@ -596,11 +803,32 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	}
 
 	/* Interpret each operation in the trace in order */
+	next_check = check_every;
 	for (i = 0; i < trace->num_ops; i++)
 	{
 		index = trace->ops[i].index;
 		size = trace->ops[i].size;
 
+		/* With -c, the heap is checked every check_every requests (or after the batch that passes them) */
+		if (check_every > 0 && i >= next_check)
+		{
+			if (mm_checkheap(check_level) < 0)
+			{
+				malloc_error(tracenum, i, "mm_checkheap found an inconsistent heap");
+				return 0;
+			}
+			next_check = i + check_every;
+		}
+
+		/* With -b, a run of requests goes through the batch API at once */
+		if ((n = batch_len(trace, i)) > 1)
+		{
+			if (eval_mm_valid_batch(trace, tracenum, i, n, ranges) == 0)
+				return 0;
+			i += n - 1;
+			continue;
+		}
+
 		switch (trace->ops[i].type)
 		{
 
@@ -621,6 +849,13 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 			if (add_range(ranges, p, size, tracenum, i) == 0)
 				return 0;
 
+			/* The block may hold more than asked for, but never less */
+			if (mm_malloc_usable_size(p) < (size_t)size)
+			{
+				malloc_error(tracenum, i, "mm_malloc_usable_size is smaller than the request");
+				return 0;
+			}
+
 			/* ADDED: cgw
 			 * fill range with low byte of index.  This will be used later
 			 * if we realloc the block and wish to make sure that the old
@@ -674,6 +909,35 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 			trace->block_sizes[index] = size;
 			break;
 
+		case CALLOC: /* mm_calloc */
+
+			/* Call the student's calloc */
+			if ((p = mm_calloc(1, size)) == NULL)
+			{
+				malloc_error(tracenum, i, "mm_calloc failed.");
+				return 0;
+			}
+
+			/* Check the new block like a malloc'ed one */
+			if (add_range(ranges, p, size, tracenum, i) == 0)
+				return 0;
+
+			/* Make sure that every byte of the block was zeroed */
+			for (j = 0; j < size; j++)
+			{
+				if (p[j] != 0)
+				{
+					malloc_error(tracenum, i, "mm_calloc did not zero the block");
+					return 0;
+				}
+			}
+			memset(p, index & 0xFF, size);
+
+			/* Remember region */
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			break;
+
 		case FREE: /* mm_free */
 
 			/* Remove region from list and call student's free function */
@@ -686,6 +950,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 			app_error("Nonexistent request type in eval_mm_valid");
 		}
 	}
+	if (check_every > 0 && mm_checkheap(check_level) < 0)
+	{
+		malloc_error(tracenum, trace->num_ops - 1, "mm_checkheap found an inconsistent heap");
+		return 0;
+	}
 
 	/* As far as we know, this is a valid malloc package */
 	return 1;
@@ -696,15 +965,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   peak size of the heap in bytes while running the student's malloc
+ *   package on the trace. mem_sbrk() lets the package shrink the heap,
+ *   so the final heap size may be smaller. Blocks the package maps
+ *   directly with mem_map() count as heap too.
  *
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {
-	int i;
+	int i, j, n;
 	int index;
 	int size, newsize, oldsize;
 	int max_total_size = 0;
@@ -719,14 +988,32 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
 	for (i = 0; i < trace->num_ops; i++)
 	{
+		if ((n = batch_len(trace, i)) > 1)
+		{
+			run_batch(trace, i, n);
+			for (j = i; j < i + n; j++)
+			{
+				size = trace->block_sizes[trace->ops[j].index];
+				total_size += trace->ops[j].type == FREE ? -size : size;
+			}
+			max_total_size = (total_size > max_total_size) ? total_size : max_total_size;
+			i += n - 1;
+			continue;
+		}
+
 		switch (trace->ops[i].type)
 		{
 
 		case ALLOC: /* mm_alloc */
+		case CALLOC: /* mm_calloc */
 			index = trace->ops[i].index;
 			size = trace->ops[i].size;
 
-			if ((p = mm_malloc(size)) == NULL)
+			if (trace->ops[i].type == CALLOC)
+				p = mm_calloc(1, size);
+			else
+				p = mm_malloc(size);
+			if (p == NULL)
 				app_error("mm_malloc failed in eval_mm_util");
 
 			/* Remember region and size */
@@ -780,7 +1067,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		}
 	}
 
-	return ((double)max_total_size / (double)mem_heapsize());
+	return ((double)max_total_size / (double)mem_peak_footprint());
 }
 
 /*
@@ -789,7 +1076,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-	int i, index, size, newsize;
+	int i, n, index, size, newsize;
 	char *p, *newp, *oldp, *block;
 	trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -800,6 +1087,14 @@ static void eval_mm_speed(void *ptr)
 
 	/* Interpret each trace request */
 	for (i = 0; i < trace->num_ops; i++)
+	{
+		if ((n = batch_len(trace, i)) > 1)
+		{
+			run_batch(trace, i, n);
+			i += n - 1;
+			continue;
+		}
+
 		switch (trace->ops[i].type)
 		{
 
@@ -811,6 +1106,14 @@ static void eval_mm_speed(void *ptr)
 			trace->blocks[index] = p;
 			break;
 
+		case CALLOC: /* mm_calloc */
+			index = trace->ops[i].index;
+			size = trace->ops[i].size;
+			if ((p = mm_calloc(1, size)) == NULL)
+				app_error("mm_calloc error in eval_mm_speed");
+			trace->blocks[index] = p;
+			break;
+
 		case REALLOC: /* mm_realloc */
 			index = trace->ops[i].index;
 			newsize = trace->ops[i].size;
@@ -829,6 +1132,268 @@ static void eval_mm_speed(void *ptr)
 		default:
 			app_error("Nonexistent request type in eval_mm_valid");
 		}
+	}
+}
+
+/*
+ * eval_arena_valid - Check the blocks of a trace with its scopes in a bump
+ *     arena, as eval_mm_valid does for mm_malloc. A block allocated between a
+ *     b and an e line comes from the arena and its free only checks it; the
+ *     arena is reset at each e line. Other blocks go through mm_malloc and
+ *     mm_free, and the arena's chunks must leave a consistent heap when it is
+ *     destroyed. Sets *skipped and returns 0 if a scope does not fit in the heap.
+ */
+static int eval_arena_valid(trace_t *trace, int tracenum, range_t **ranges, char **skipped)
+{
+	int i, j, index, size, oldsize;
+	char *p, *oldp;
+	mm_arena_t *arena;
+
+	/* Reset the heap and free any records in the range list */
+	mem_reset_brk();
+	clear_ranges(ranges);
+	if (mm_init() < 0 || (arena = mm_arena_create(NULL, 0)) == NULL)
+	{
+		malloc_error(tracenum, 0, "mm_arena_create failed.");
+		return 0;
+	}
+
+	for (i = 0; i < trace->num_ops; i++)
+	{
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		oldp = trace->blocks[index];
+		oldsize = trace->block_sizes[index];
+		switch (trace->ops[i].type)
+		{
+		case ALLOC:	/* mm_arena_alloc or mm_malloc */
+		case CALLOC: /* mm_arena_alloc and clear, or mm_calloc */
+		case REALLOC: /* mm_arena_alloc and copy, or mm_realloc */
+			if (!trace->ops[i].scoped && trace->ops[i].type == ALLOC)
+				p = mm_malloc(size);
+			else if (!trace->ops[i].scoped && trace->ops[i].type == CALLOC)
+				p = mm_calloc(1, size);
+			else if (!trace->ops[i].scoped)
+				p = mm_realloc(oldp, size);
+			else if ((p = mm_arena_alloc(arena, size)) == NULL)
+			{
+				/* Not an allocator error: without frees, a scope may need more than the heap */
+				*skipped = "a scope does not fit in the heap";
+				mm_arena_destroy(arena);
+				return 0;
+			}
+			if (p == NULL)
+			{
+				malloc_error(tracenum, i, "mm_malloc failed outside the scopes.");
+				return 0;
+			}
+			if (trace->ops[i].type == REALLOC)
+			{
+				/* In a scope the copy is ours, and the old block stays until the reset */
+				if (trace->ops[i].scoped)
+					memcpy(p, oldp, oldsize < size ? oldsize : size);
+				remove_range(ranges, oldp);
+				for (j = 0; j < oldsize && j < size; j++)
+					if (p[j] != (char)(index & 0xFF))
+					{
+						malloc_error(tracenum, i, "realloc did not preserve the data from the old block");
+						return 0;
+					}
+			}
+			if (add_range(ranges, p, size, tracenum, i) == 0)
+				return 0;
+			memset(p, index & 0xFF, size);
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			break;
+
+		case FREE: /* check the block, and mm_free it outside the scopes */
+			for (j = 0; j < oldsize; j++)
+				if (oldp[j] != (char)(index & 0xFF))
+				{
+					malloc_error(tracenum, i, "a live block was overwritten");
+					return 0;
+				}
+			remove_range(ranges, oldp);
+			if (!trace->ops[i].scoped)
+				mm_free(oldp);
+			break;
+
+		default:
+			app_error("Nonexistent request type in eval_arena_valid");
+		}
+
+		/* Every block of the scope is freed by now */
+		if (trace->ops[i].scope_end)
+			mm_arena_reset(arena);
+	}
+
+	mm_arena_destroy(arena);
+	if (mm_checkheap(2) < 0)
+	{
+		malloc_error(tracenum, trace->num_ops - 1, "mm_arena_destroy left an inconsistent heap");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * eval_arena_speed - This is the function that is used by fcyc()
+ *    to measure the running time of a trace with its scopes in a bump arena.
+ */
+static void eval_arena_speed(void *ptr)
+{
+	int i, index, size, oldsize;
+	char *p;
+	trace_t *trace = ((speed_t *)ptr)->trace;
+	mm_arena_t *arena;
+
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	if (mm_init() < 0 || (arena = mm_arena_create(NULL, 0)) == NULL)
+		app_error("mm_arena_create failed in eval_arena_speed");
+
+	/* Interpret each trace request */
+	for (i = 0; i < trace->num_ops; i++)
+	{
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		switch (trace->ops[i].type)
+		{
+		case ALLOC: /* mm_arena_alloc in a scope, mm_malloc outside */
+			p = trace->ops[i].scoped ? mm_arena_alloc(arena, size) : mm_malloc(size);
+			if (p == NULL)
+				app_error("mm_arena_alloc error in eval_arena_speed");
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			break;
+
+		case CALLOC: /* mm_arena_alloc and clear, or mm_calloc */
+			if (!trace->ops[i].scoped)
+				p = mm_calloc(1, size);
+			else if ((p = mm_arena_alloc(arena, size)) != NULL)
+				memset(p, 0, size);
+			if (p == NULL)
+				app_error("mm_arena_alloc error in eval_arena_speed");
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			break;
+
+		case REALLOC: /* mm_arena_alloc and copy, or mm_realloc */
+			oldsize = trace->block_sizes[index];
+			if (!trace->ops[i].scoped)
+				p = mm_realloc(trace->blocks[index], size);
+			else if ((p = mm_arena_alloc(arena, size)) != NULL)
+				memcpy(p, trace->blocks[index], oldsize < size ? oldsize : size);
+			if (p == NULL)
+				app_error("mm_arena_alloc error in eval_arena_speed");
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			break;
+
+		case FREE: /* in a scope, freed with the rest of it */
+			if (!trace->ops[i].scoped)
+				mm_free(trace->blocks[index]);
+			break;
+
+		default:
+			app_error("Nonexistent request type in eval_arena_speed");
+		}
+
+		if (trace->ops[i].scope_end)
+			mm_arena_reset(arena);
+	}
+	mm_arena_destroy(arena);
+}
+
+/*
+ * batch_len - With -b, the number of requests from op i on that make one batch:
+ *     consecutive mallocs of the same size, or consecutive frees. 1 otherwise.
+ */
+static int batch_len(trace_t *trace, int i)
+{
+	int n = 1;
+	traceop_t *op = &trace->ops[i];
+
+	if (batch < 2 || (op->type != ALLOC && op->type != FREE))
+		return 1;
+	while (n < batch && i + n < trace->num_ops &&
+				 trace->ops[i + n].type == op->type &&
+				 (op->type == FREE || trace->ops[i + n].size == op->size))
+		n++;
+	return n;
+}
+
+/*
+ * eval_mm_valid_batch - Check a batch of n requests starting at op i,
+ *     the same way eval_mm_valid checks a single one
+ */
+static int eval_mm_valid_batch(trace_t *trace, int tracenum, int i, int n,
+															 range_t **ranges)
+{
+	void *blocks[MAX_BATCH];
+	int j, index;
+	int size = trace->ops[i].size;
+	char *p;
+
+	if (trace->ops[i].type == FREE)
+	{
+		for (j = 0; j < n; j++)
+		{
+			blocks[j] = trace->blocks[trace->ops[i + j].index];
+			remove_range(ranges, blocks[j]);
+		}
+		mm_free_batch(blocks, n);
+		return 1;
+	}
+
+	if (mm_malloc_batch(size, n, blocks) != (size_t)n)
+	{
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	}
+	for (j = 0; j < n; j++)
+	{
+		index = trace->ops[i + j].index;
+		p = blocks[j];
+		if (add_range(ranges, p, size, tracenum, i + j) == 0)
+			return 0;
+		if (mm_malloc_usable_size(p) < (size_t)size)
+		{
+			malloc_error(tracenum, i + j, "mm_malloc_usable_size is smaller than the request");
+			return 0;
+		}
+		memset(p, index & 0xFF, size);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+	}
+	return 1;
+}
+
+/*
+ * run_batch - Replay n requests starting at op i with one batch call
+ */
+static void run_batch(trace_t *trace, int i, int n)
+{
+	void *blocks[MAX_BATCH];
+	int j, index;
+
+	if (trace->ops[i].type == FREE)
+	{
+		for (j = 0; j < n; j++)
+			blocks[j] = trace->blocks[trace->ops[i + j].index];
+		mm_free_batch(blocks, n);
+		return;
+	}
+
+	if (mm_malloc_batch(trace->ops[i].size, n, blocks) != (size_t)n)
+		app_error("mm_malloc_batch failed");
+	for (j = 0; j < n; j++)
+	{
+		index = trace->ops[i + j].index;
+		trace->blocks[index] = blocks[j];
+		trace->block_sizes[index] = trace->ops[i].size;
+	}
 }
 
 /*
@@ -856,6 +1421,15 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 			trace->blocks[trace->ops[i].index] = p;
 			break;
 
+		case CALLOC: /* calloc */
+			if ((p = calloc(1, trace->ops[i].size)) == NULL)
+			{
+				malloc_error(tracenum, i, "libc calloc failed");
+				unix_error("System message");
+			}
+			trace->blocks[trace->ops[i].index] = p;
+			break;
+
 		case REALLOC: /* realloc */
 			newsize = trace->ops[i].size;
 			oldp = trace->blocks[trace->ops[i].index];
@@ -903,6 +1477,14 @@ static void eval_libc_speed(void *ptr)
 			trace->blocks[index] = p;
 			break;
 
+		case CALLOC: /* calloc */
+			index = trace->ops[i].index;
+			size = trace->ops[i].size;
+			if ((p = calloc(1, size)) == NULL)
+				unix_error("calloc failed in eval_libc_speed");
+			trace->blocks[index] = p;
+			break;
+
 		case REALLOC: /* realloc */
 			index = trace->ops[i].index;
 			newsize = trace->ops[i].size;
@@ -937,19 +1519,26 @@ static void printresults(int n, stats_t *stats)
 	double util = 0;
 
 	/* Print the individual results for each trace */
-	printf("%5s%7s %5s%8s%10s%6s\n",
-				 "trace", " valid", "util", "ops", "secs", "Kops");
+	printf("%5s%7s %5s%8s%10s%6s%9s%9s\n",
+				 "trace", " valid", "util", "ops", "secs", "Kops", "peak KB", "final KB");
 	for (i = 0; i < n; i++)
 	{
 		if (stats[i].valid)
 		{
-			printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n",
+			printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f",
 						 i,
 						 "yes",
 						 stats[i].util * 100.0,
 						 stats[i].ops,
 						 stats[i].secs,
 						 (stats[i].ops / 1e3) / stats[i].secs);
+			/* Heap sizes are only known for the mm package */
+			if (stats[i].peak_heap > 0)
+				printf("%9.0f%9.0f\n",
+							 stats[i].peak_heap / 1024.0,
+							 stats[i].final_heap / 1024.0);
+			else
+				printf("%9s%9s\n", "-", "-");
 			secs += stats[i].secs;
 			ops += stats[i].ops;
 			util += stats[i].util;
@@ -987,6 +1576,133 @@ static void printresults(int n, stats_t *stats)
 	}
 }
 
+/*
+ * printorder - Print the utilization and throughput of each trace
+ *     with LIFO free lists next to those with address-ordered ones
+ */
+static void printorder(int n, stats_t *lifo, stats_t *ordered)
+{
+	int i;
+	stats_t *runs[2] = {lifo, ordered};
+	double util[2] = {0, 0};
+	double ops[2] = {0, 0};
+	double secs[2] = {0, 0};
+	int k, complete = 1;
+
+	printf("%5s%12s%8s%12s%8s\n", "trace", "LIFO util", "Kops", "addr util", "Kops");
+	for (i = 0; i < n; i++)
+	{
+		printf("%2d   ", i);
+		for (k = 0; k < 2; k++)
+		{
+			if (runs[k][i].valid)
+			{
+				printf("%11.0f%%%8.0f",
+							 runs[k][i].util * 100.0,
+							 (runs[k][i].ops / 1e3) / runs[k][i].secs);
+				util[k] += runs[k][i].util;
+				ops[k] += runs[k][i].ops;
+				secs[k] += runs[k][i].secs;
+			}
+			else
+			{
+				printf("%12s%8s", "-", "-");
+				complete = 0;
+			}
+		}
+		printf("\n");
+	}
+
+	/* Print the aggregate results for the set of traces */
+	printf("Total");
+	for (k = 0; k < 2; k++)
+		if (complete)
+			printf("%11.0f%%%8.0f", (util[k] / n) * 100.0, (ops[k] / 1e3) / secs[k]);
+		else
+			printf("%12s%8s", "-", "-");
+	printf("\n");
+}
+
+/*
+ * printarena - Print the throughput of each trace with malloc/free next
+ *     to that with its scopes in a bump arena, then why any trace was skipped
+ */
+static void printarena(int n, stats_t *plain, stats_t *arena, int *scopes, char **skipped)
+{
+	int i;
+	double plain_secs = 0, arena_secs = 0, ops = 0;
+	int complete = 1, ran = 0;
+
+	printf("%5s%8s%8s%10s%11s%9s\n", "trace", "scopes", "ops", "free Kops", "arena Kops", "speedup");
+	for (i = 0; i < n; i++)
+	{
+		if (plain[i].valid && arena[i].valid)
+		{
+			printf("%2d%11d%8.0f%10.0f%11.0f%8.2fx\n",
+						 i,
+						 scopes[i],
+						 plain[i].ops,
+						 (plain[i].ops / 1e3) / plain[i].secs,
+						 (arena[i].ops / 1e3) / arena[i].secs,
+						 plain[i].secs / arena[i].secs);
+			plain_secs += plain[i].secs;
+			arena_secs += arena[i].secs;
+			ops += plain[i].ops;
+			ran++;
+		}
+		else
+		{
+			printf("%2d%11s%8s%10s%11s%9s\n", i, "-", "-", "-", "-", "-");
+			complete &= skipped[i] != NULL;
+		}
+	}
+
+	/* Print the aggregate results over the traces that ran */
+	if (complete && ran > 0)
+		printf("Total%16.0f%10.0f%11.0f%8.2fx\n",
+					 ops,
+					 (ops / 1e3) / plain_secs,
+					 (ops / 1e3) / arena_secs,
+					 plain_secs / arena_secs);
+	else
+		printf("Total%16s%10s%11s%9s\n", "-", "-", "-", "-");
+	for (i = 0; i < n; i++)
+		if (skipped[i] != NULL)
+			printf("Skipped trace %d: %s\n", i, skipped[i]);
+}
+
+/*
+ * print_mm_stats - Print the counters and free space that mm_stats reports
+ *     at the end of the util pass of a trace
+ */
+static void print_mm_stats(char *tracefile)
+{
+	struct mm_stats st;
+	int i;
+
+	mm_stats(&st);
+	printf("\nStats for %s:\n", tracefile);
+	printf("  find_fit %lu calls, %.1f probes/call; %lu splits, %lu coalesces\n",
+		   st.counters.fit_calls,
+		   st.counters.fit_calls ? (double)st.counters.fit_probes / st.counters.fit_calls : 0.0,
+		   st.counters.splits, st.counters.coalesces);
+	printf("  extend_heap %lu calls, %zu KB; realloc %lu in place, %lu copied\n",
+		   st.counters.extends, st.counters.extend_bytes / 1024,
+		   st.counters.realloc_in_place, st.counters.realloc_copies);
+	printf("  free %zu KB, largest block %zu KB, fragmentation %.0f%%; quick lists %lu blocks, %zu KB\n",
+		   st.total_free / 1024, st.largest_free / 1024, st.fragmentation * 100.0,
+		   st.quick_blocks, st.quick_bytes / 1024);
+	printf("  free blocks by size:");
+	for (i = 0; i < MM_STATS_CLASSES; i++)
+		if (st.free_blocks[i] == 0)
+			continue;
+		else if (i == MM_STATS_CLASSES - 1)
+			printf(" >%zu:%lu", (size_t)1 << (i - 1), st.free_blocks[i]);
+		else
+			printf(" <=%zu:%lu", (size_t)1 << i, st.free_blocks[i]);
+	printf("\n");
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1019,12 +1735,21 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void)
 {
-	fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+	fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>] [-b <n>] [-c <n>[,<level>]]\n"
+					"               [-p <pages>] [-m <size>] [-F <fit>] [-Aos]\n");
 	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-A         Compare the scopes of each trace in a bump arena with malloc/free.\n");
+	fprintf(stderr, "\t-b <n>     Batch runs of same-size mallocs and of frees, up to n.\n");
+	fprintf(stderr, "\t-c <n>[,<level>] Run mm_checkheap (level 1-3, default 3) every n requests.\n");
 	fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+	fprintf(stderr, "\t-F <fit>   Placement policy: good, first, best[:<probes>], address or next.\n");
 	fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
 	fprintf(stderr, "\t-h         Print this message.\n");
 	fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+	fprintf(stderr, "\t-o         Compare address-ordered free lists with LIFO ones.\n");
+	fprintf(stderr, "\t-p <pages> Back the heap with small, thp or hugetlb pages.\n");
+	fprintf(stderr, "\t-s         Print allocator statistics (counters need MMFLAGS=-DSTATS=1).\n");
+	fprintf(stderr, "\t-m <size>  Reserve size bytes (K, M, G suffixes) for the heap.\n");
 	fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
 	fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
 	fprintf(stderr, "\t-V         Print additional debug info.\n");
@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +11,188 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* a simulated heap: a contiguous area with its own brk pointer */
+struct mem_region {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */
+    char *commit;     /* end of the pages made accessible so far */
+    size_t chunk;     /* pages are made accessible this many bytes at a time */
+    char *peak_brk;   /* highest brk since the last reset */
+    char *fresh;      /* bytes from here up are zero: not handed out since mapped or released */
+    int pages;        /* MEM_PAGES_* the region got */
+};
+
+/* a direct mapping made by mem_map, outside any heap */
+typedef struct mem_mapping {
+    char *start;
+    size_t size;
+    struct mem_mapping *next;
+} mem_mapping_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_region_t mem_heap;  /* the heap of mem_sbrk and friends */
+
+/* pages of the regions made from now on */
+static int page_mode = MEM_PAGES_SMALL;
+#define HUGE_PAGE_SIZE (1 << 21)
+#define COMMIT_CHUNK (1 << 20)
+
+/* reserved size of the default heap, 0 for MEM_HEAP_SIZE or MAX_HEAP */
+static size_t heap_max;
+
+/* direct mappings and the footprint counters, all guarded by mem_lock */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_mapping_t *mappings;
+static size_t mapped;          /* bytes in direct mappings */
+static size_t heap_bytes;      /* size of the default heap */
+static size_t peak_footprint;  /* largest heap_bytes + mapped since the last reset */
+
+/*
+ * map_aligned - map size bytes at an address that is a multiple of align
+ */
+static void *map_aligned(size_t size, size_t align)
+{
+    char *p = mmap(NULL, size + align, PROT_NONE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+	return MAP_FAILED;
+
+    size_t lead = (align - (size_t)p % align) % align;
+    if (lead != 0)
+	munmap(p, lead);
+    munmap(p + lead + size, align - lead);
+    return p + lead;
+}
+
+/*
+ * region_init - reserve the address range of a region of size bytes.
+ *    Nothing is accessible until region_commit opens it as brk advances,
+ *    so a large reservation costs nothing up front. It is mapped rather
+ *    than malloc'ed so that pages above a shrunk brk can be released.
+ *    With huge pages, hugetlbfs pages are tried first (these are committed
+ *    whole, as the kernel reserves them at mmap), then a 2 MB aligned range
+ *    that asks for transparent huge pages.
+ */
+static int region_init(mem_region_t *r, size_t size)
+{
+    void *p = MAP_FAILED;
+
+    r->pages = MEM_PAGES_SMALL;
+#ifdef MAP_HUGETLB
+    if (page_mode == MEM_PAGES_HUGETLB) {
+	size_t hsize = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+	p = mmap(NULL, hsize, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+	    size = hsize;
+	    r->pages = MEM_PAGES_HUGETLB;
+	    r->commit = (char *)p + size;
+	}
+    }
+#endif
+    if (p == MAP_FAILED && page_mode != MEM_PAGES_SMALL) {
+	p = map_aligned(size, HUGE_PAGE_SIZE);
+#ifdef MADV_HUGEPAGE
+	if (p != MAP_FAILED && madvise(p, size, MADV_HUGEPAGE) == 0)
+	    r->pages = MEM_PAGES_THP;
+#endif
+    }
+    if (p == MAP_FAILED)
+	p = mmap(NULL, size, PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+	return -1;
+
+    if (r->pages != MEM_PAGES_HUGETLB)
+	r->commit = (char *)p;
+    r->chunk = r->pages == MEM_PAGES_SMALL ? COMMIT_CHUNK : HUGE_PAGE_SIZE;
+    r->start_brk = (char *)p;
+    r->max_addr = r->start_brk + size;  /* max legal heap address */
+    r->brk = r->start_brk;              /* heap is empty initially */
+    r->peak_brk = r->start_brk;
+    r->fresh = r->start_brk;
+    return 0;
+}
+
+/*
+ * region_commit - make the pages up to brk accessible, a chunk at a time
+ */
+static int region_commit(mem_region_t *r, char *brk)
+{
+    if (brk <= r->commit)
+	return 0;
+
+    char *end = r->start_brk + (brk - r->start_brk + r->chunk - 1) / r->chunk * r->chunk;
+    if (end > r->max_addr)
+	end = r->max_addr;
+    if (mprotect(r->commit, end - r->commit, PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    r->commit = end;
+    return 0;
+}
+
+/*
+ * region_release - give the whole pages between lo and hi back to the OS.
+ *    They read as zero when touched again.
+ */
+static void region_release(mem_region_t *r, char *lo, char *hi)
+{
+    size_t pagesize = mem_pagesize();
+    char *start = r->start_brk + (lo - r->start_brk + pagesize - 1) / pagesize * pagesize;
+    char *end = r->start_brk + (hi - r->start_brk + pagesize - 1) / pagesize * pagesize;
+
+    /* hugetlbfs pages cannot be released in part */
+    if (start < end && madvise(start, end - start, MADV_DONTNEED) == 0) {
+	if (end >= r->fresh)
+	    r->fresh = start;
+    }
+}
+
+/*
+ * footprint_update - record a new heap size or mapped total (mem_lock held)
+ */
+static void footprint_update(void)
+{
+    if (heap_bytes + mapped > peak_footprint)
+	peak_footprint = heap_bytes + mapped;
+}
+
+/*
+ * heap_changed - mirror the size of the default heap for the footprint counters
+ */
+static void heap_changed(mem_region_t *r)
+{
+    if (r != &mem_heap)
+	return;
+    pthread_mutex_lock(&mem_lock);
+    heap_bytes = mem_region_heapsize(r);
+    footprint_update();
+    pthread_mutex_unlock(&mem_lock);
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    char *env;
+
+    if (heap_max == 0 && (env = getenv("MEM_HEAP_SIZE")) != NULL)
+	heap_max = mem_parse_size(env);
+    if (heap_max == 0)
+	heap_max = MAX_HEAP;
+
+    /* reserve the address range we will use to model the available VM */
+    if (region_init(&mem_heap, heap_max) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,33 +200,64 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_heap.start_brk, mem_region_maxsize(&mem_heap));
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_set_heap_size - set the size reserved for the default heap by mem_init,
+ *    over the MEM_HEAP_SIZE environment variable and MAX_HEAP
+ */
+void mem_set_heap_size(size_t size)
+{
+    heap_max = size;
+}
+
+/*
+ * mem_parse_size - parse a byte count with an optional K, M or G suffix;
+ *    returns 0 if s is not one
+ */
+size_t mem_parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g':
+	n <<= 10;
+	/* fall through */
+    case 'M': case 'm':
+	n <<= 10;
+	/* fall through */
+    case 'K': case 'k':
+	n <<= 10;
+	end++;
+	break;
+    }
+    if (end == s || *end != '\0')
+	return 0;
+    return (size_t)n;
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty, zeroed heap
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_region_reset_brk(&mem_heap);
+    pthread_mutex_lock(&mem_lock);
+    peak_footprint = mapped;
+    pthread_mutex_unlock(&mem_lock);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap and releases the pages above
+ *    the new brk.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_region_sbrk(&mem_heap, incr);
 }
 
 /*
@@ -73,7 +265,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(&mem_heap);
 }
 
 /* 
@@ -81,7 +273,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(&mem_heap);
 }
 
 /*
@@ -89,7 +281,128 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_heapsize(&mem_heap);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size since the last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_region_peak_heapsize(&mem_heap);
+}
+
+/*
+ * mem_footprint() - returns the heap size plus the bytes in direct mappings
+ */
+size_t mem_footprint()
+{
+    pthread_mutex_lock(&mem_lock);
+    size_t footprint = heap_bytes + mapped;
+    pthread_mutex_unlock(&mem_lock);
+    return footprint;
+}
+
+/*
+ * mem_peak_footprint() - returns the largest footprint since the last reset
+ */
+size_t mem_peak_footprint()
+{
+    pthread_mutex_lock(&mem_lock);
+    size_t footprint = peak_footprint;
+    pthread_mutex_unlock(&mem_lock);
+    return footprint;
+}
+
+/*
+ * mem_map - map size bytes, a multiple of the page size, apart from any heap.
+ *    Returns NULL if out of memory.
+ */
+void *mem_map(size_t size)
+{
+    mem_mapping_t *m;
+    void *p;
+
+    if ((m = (mem_mapping_t *)malloc(sizeof(mem_mapping_t))) == NULL)
+	return NULL;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+	free(m);
+	return NULL;
+    }
+    m->start = (char *)p;
+    m->size = size;
+
+    pthread_mutex_lock(&mem_lock);
+    m->next = mappings;
+    mappings = m;
+    mapped += size;
+    footprint_update();
+    pthread_mutex_unlock(&mem_lock);
+    return p;
+}
+
+/*
+ * mem_remap - resize a mapping made by mem_map to size bytes, moving it if
+ *    it cannot grow in place. Returns NULL, keeping the old mapping, if out
+ *    of memory.
+ */
+void *mem_remap(void *p, size_t size)
+{
+    mem_mapping_t *m;
+    void *q;
+
+    pthread_mutex_lock(&mem_lock);
+    for (m = mappings; m != NULL && m->start != (char *)p; m = m->next)
+	;
+    assert(m != NULL);
+    q = mremap(p, m->size, size, MREMAP_MAYMOVE);
+    if (q == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_lock);
+	return NULL;
+    }
+    mapped += size - m->size;
+    m->start = (char *)q;
+    m->size = size;
+    footprint_update();
+    pthread_mutex_unlock(&mem_lock);
+    return q;
+}
+
+/*
+ * mem_unmap - give back a mapping made by mem_map
+ */
+void mem_unmap(void *p)
+{
+    mem_mapping_t **link, *m;
+
+    pthread_mutex_lock(&mem_lock);
+    for (link = &mappings; *link != NULL && (*link)->start != (char *)p; link = &(*link)->next)
+	;
+    assert(*link != NULL);
+    m = *link;
+    *link = m->next;
+    mapped -= m->size;
+    pthread_mutex_unlock(&mem_lock);
+
+    munmap(m->start, m->size);
+    free(m);
+}
+
+/*
+ * mem_is_mapped - whether the bytes from lo to hi lie in one direct mapping
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    mem_mapping_t *m;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_lock);
+    for (m = mappings; m != NULL && !found; m = m->next)
+	found = (char *)lo >= m->start && (char *)hi < m->start + m->size;
+    pthread_mutex_unlock(&mem_lock);
+    return found;
 }
 
 /*
@@ -99,3 +412,150 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_set_pages - choose the pages of the regions made from now on, the
+ *    default heap included if called before mem_init: MEM_PAGES_SMALL,
+ *    MEM_PAGES_THP or MEM_PAGES_HUGETLB
+ */
+void mem_set_pages(int mode)
+{
+    page_mode = mode;
+}
+
+/*
+ * mem_default_region - return the region behind mem_sbrk
+ */
+mem_region_t *mem_default_region()
+{
+    return &mem_heap;
+}
+
+/*
+ * mem_region_create - make a new empty region of at most size bytes,
+ *    independent of the default heap. Returns NULL if out of memory.
+ */
+mem_region_t *mem_region_create(size_t size)
+{
+    mem_region_t *r;
+
+    if ((r = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL)
+	return NULL;
+    if (region_init(r, size) < 0) {
+	free(r);
+	return NULL;
+    }
+    return r;
+}
+
+/*
+ * mem_region_destroy - free a region made by mem_region_create
+ */
+void mem_region_destroy(mem_region_t *r)
+{
+    munmap(r->start_brk, mem_region_maxsize(r));
+    free(r);
+}
+
+/*
+ * mem_region_reset_brk - reset the brk pointer of a region to make it empty.
+ *    The pages stay mapped, so that a heap rebuilt after a reset does not
+ *    fault them in again; fresh stays at the highest byte handed out.
+ */
+void mem_region_reset_brk(mem_region_t *r)
+{
+    r->brk = r->start_brk;
+    r->peak_brk = r->start_brk;
+    heap_changed(r);
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk on a region
+ */
+void *mem_region_sbrk(mem_region_t *r, intptr_t incr)
+{
+    char *old_brk = r->brk;
+
+    if (incr < 0) {
+	if (-incr > r->brk - r->start_brk) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Heap shrunk below its start...\n");
+	    return (void *)-1;
+	}
+	r->brk += incr;
+	region_release(r, r->brk, old_brk);
+	heap_changed(r);
+	return (void *)old_brk;
+    }
+    if (incr > r->max_addr - r->brk || region_commit(r, r->brk + incr) < 0) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    r->brk += incr;
+    if (r->brk > r->peak_brk)
+	r->peak_brk = r->brk;
+    if (r->brk > r->fresh)
+	r->fresh = r->brk;
+    heap_changed(r);
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region
+ */
+void *mem_region_lo(mem_region_t *r)
+{
+    return (void *)r->start_brk;
+}
+
+/*
+ * mem_region_hi - return address of the last heap byte of a region
+ */
+void *mem_region_hi(mem_region_t *r)
+{
+    return (void *)(r->brk - 1);
+}
+
+/*
+ * mem_region_heapsize - returns the heap size of a region in bytes
+ */
+size_t mem_region_heapsize(mem_region_t *r)
+{
+    return (size_t)(r->brk - r->start_brk);
+}
+
+/*
+ * mem_region_fresh - return the address from which all bytes of a region are
+ *    zero, because mem_sbrk has not handed them out since they were mapped
+ *    or released
+ */
+void *mem_region_fresh(mem_region_t *r)
+{
+    return (void *)r->fresh;
+}
+
+/*
+ * mem_region_peak_heapsize - returns the largest heap size of a region since its last reset
+ */
+size_t mem_region_peak_heapsize(mem_region_t *r)
+{
+    return (size_t)(r->peak_brk - r->start_brk);
+}
+
+/*
+ * mem_region_pages - returns the MEM_PAGES_* a region got, which may be
+ *    less than asked for if the system has no huge pages to give
+ */
+int mem_region_pages(mem_region_t *r)
+{
+    return r->pages;
+}
+
+/*
+ * mem_region_maxsize - returns the largest heap size a region can grow to
+ */
+size_t mem_region_maxsize(mem_region_t *r)
+{
+    return (size_t)(r->max_addr - r->start_brk);
+}
@@ -1,11 +1,48 @@
 #include <unistd.h>
+#include <stdint.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
 
+/* Direct mappings apart from the heap, counted in the footprint with it */
+void *mem_map(size_t size);
+void *mem_remap(void *p, size_t size);
+void mem_unmap(void *p);
+int mem_is_mapped(void *lo, void *hi);
+size_t mem_footprint(void);
+size_t mem_peak_footprint(void);
+
+
+/* Pages backing the regions */
+#define MEM_PAGES_SMALL 0   /* base pages */
+#define MEM_PAGES_THP 1     /* 2 MB aligned, transparent huge pages requested with madvise */
+#define MEM_PAGES_HUGETLB 2 /* hugetlbfs pages (MAP_HUGETLB), else as MEM_PAGES_THP */
+void mem_set_pages(int mode);
+
+/* Size reserved for the default heap: mem_set_heap_size, else the
+   MEM_HEAP_SIZE environment variable (e.g. 64G), else MAX_HEAP */
+void mem_set_heap_size(size_t size);
+size_t mem_parse_size(const char *s);
+
+/* Independent simulated heaps; the functions above work on the default one */
+typedef struct mem_region mem_region_t;
+
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(size_t size);
+void mem_region_destroy(mem_region_t *r);
+void mem_region_reset_brk(mem_region_t *r);
+void *mem_region_sbrk(mem_region_t *r, intptr_t incr);
+void *mem_region_lo(mem_region_t *r);
+void *mem_region_hi(mem_region_t *r);
+void *mem_region_fresh(mem_region_t *r);
+size_t mem_region_heapsize(mem_region_t *r);
+size_t mem_region_peak_heapsize(mem_region_t *r);
+size_t mem_region_maxsize(mem_region_t *r);
+int mem_region_pages(mem_region_t *r);
@@ -1,34 +1,82 @@
 /*
  * mm-seglist.c
  *
- * header와 footer에는 implicit list와 동일하게 block 크기와 할당 여부를 저장합니다.
- * free block의 경우 previous and next free block를 data로 갖으며 block 크기에 따라 doubly linked list를 구성합니다.
- * free_list는 segrated list로, 각 인덱스 n에는 2^n에서 2^(n+1) - 1 크기의 free block을 갖습니다.
- * 또한, 8-byte align이기 때문에 인덱스 0-2은 사용하지 않습니다.
- * malloc 할 때, heap 끝(마지막) block이 free block인지 판단하여 추가로 필요한 공간만 확장합니다.
- * realloc의 동작은 3가지 경우로 나눕니다.
- * 1. 크기가 줄어드는 경우, header와 footer만 수정하여 재할당 없이 크기를 수정합니다.
- * 2. 크기가 늘어나지만, 해당 블록 이후로 free block만 있거나 아무 block이 없는 경우, 필요한 공간을 확장한 후, 재할당 없이 크기를 수정합니다.
- * 3. 그 외는 메모리를 새로 할당하고, 데이터를 옮긴 후, 기존 메모리를 해제합니다.
+ * header에는 block 크기와 할당 여부, 그리고 이전 block의 할당 여부(prev_alloc bit)를 저장하고, footer는 free block에만 둡니다.
+ * free block은 크기별 segregated list로 관리하며, list의 link는 heap 시작으로부터의 32-bit offset으로 저장합니다.
+ * 비어있지 않은 class는 bitmap으로 찾고, 가장 큰 class는 red-black tree에서 best fit을 찾습니다. TLSF=1이면 two-level segregated fit을 씁니다.
+ * 요청은 크기에 따라 다음 순서로 처리합니다.
+ * 1. SLAB_MAX 이하는 header 없는 slab slot에서 할당합니다.
+ * 2. QUICK_MAX 이하는 free 된 같은 크기의 block을 quick list에서 먼저 찾습니다.
+ * 3. 그 외는 free list에서 찾고, 없으면 heap을 확장합니다. heap 끝의 큰 free block은 TOP_PAD만 남기고 줄입니다.
+ * 4. MMAP_THRESHOLD 이상은 block마다 따로 mapping을 받습니다.
+ * realloc은 가능하면 앞뒤의 free block이나 heap 끝으로 제자리에서 크기를 바꾸고, 안 되면 새로 할당하여 복사합니다.
+ * heap의 모든 상태는 arena_t에 두며, THREADS=1이면 여러 arena와 thread cache를 씁니다. mm_ctx_*와 mm_arena_*도 arena 위에 만듭니다.
+ * 각 기능의 자세한 설명은 README와 각 정의의 주석에 있습니다.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "sizeclass.h"
 
+#if defined(__LP64__)
+#define WSIZE 8      /* Word and header/footer size (bytes) */
+#define DSIZE 16     /* Double word size (bytes) */
+#define ALIGN_LOG2 4 /* log2 of DSIZE */
+#else
 #define WSIZE 4 /* Word and header/footer size (bytes) */
 #define DSIZE 8 /* Double word size (bytes) */
+#define ALIGN_LOG2 3
+#endif
 #define CHUNCKSIZE (1 << 12)
 
+/* Trim the heap once the free block at its end exceeds TOP_PAD by TRIM_THRESHOLD bytes, keeping TOP_PAD bytes of it,
+   so that a heap freeing and reallocating near its top does not shrink and regrow on every cycle.
+   Build with -DTRIM_THRESHOLD=0 to keep the heap at its peak size */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (1 << 17)
+#endif
+#ifndef TOP_PAD
+#define TOP_PAD TRIM_THRESHOLD
+#endif
+
+/* Requests of MMAP_THRESHOLD bytes or more get a direct mapping of their own, which free unmaps at once.
+   Build with -DMMAP_THRESHOLD=0 to serve them from the heap */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (1 << 17)
+#endif
+
+/* Chunk size of mm_arena_create's bump allocators, kept below MMAP_THRESHOLD so chunks come from the heap */
+#define BUMP_CHUNK (1 << 16)
+
+/* Build with -DSTATS=1 to count allocator events for mm_stats. The counters compile to nothing otherwise */
+#ifndef STATS
+#define STATS 0
+#endif
+#if STATS
+#define STAT_ADD(a, field, n) ((a)->stats.field += (n))
+#define STAT_SHARED(field) __atomic_fetch_add(&shared_stats.field, 1, __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(a, field, n) ((void)0)
+#define STAT_SHARED(field) ((void)0)
+#endif
+#define STAT_INC(a, field) STAT_ADD(a, field, 1)
+
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
-#define ASIZE(size) ((((size) + (DSIZE - 1)) & ~0x7) + DSIZE)
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MIN_BLOCK (2 * DSIZE) /* header, next and prev links, footer */
+#define ASIZE(size) MAX((((size) + WSIZE + (DSIZE - 1)) & ~(DSIZE - 1)), MIN_BLOCK)
+#define ALIGN(size) (((size) + (DSIZE - 1)) & ~(size_t)(DSIZE - 1))
 
-/* Pack a size and allocated bit intoa word */
-#define PACK(size, alloc) ((size) | (alloc))
+/* Pack a size, previous block's allocated bit and allocated bit into a word */
+#define PACK(size, prev_alloc, alloc) ((size) | ((prev_alloc) << 1) | (alloc))
 
 /* Read and write a word at address p */
 #define GET(p) (*(size_t *)(p))
@@ -37,308 +85,2836 @@
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) ((GET(p) >> 1) & 0x1)
+
+/* Set or clear the previous block's allocated bit of the header at address p */
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | 0x2)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~0x2)
+
+/* Read or set the grown bit of an allocated block's header: the block was last resized by a growing realloc */
+#define GET_GROWN(p) (GET(p) & 0x4)
+#define SET_GROWN(p) PUT(p, GET(p) | 0x4)
+
+/* Read the zero bit of a free block's header (0 for allocated blocks): all of its payload but the links and footer is zero */
+#define GET_ZERO(p) (GET_ALLOC(p) ? 0 : GET(p) & 0x4)
+
+/* A direct-mapped block has a header of size 0 with the alloc and mapped bits, after a word holding the mapping size */
+#define MAPPED_HDR (PACK(0, 0, 1) | 0x4)
+#define MAP_SIZE(bp) GET((void *)(bp) - DSIZE)
 
-/* Given block ptr pb, compute address of its header and footer */
+/* Given block ptr pb, compute address of its header and footer (free blocks only) */
 #define HDRP(bp) ((void *)(bp) - WSIZE)
 #define FTRP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks (previous block must be free) */
 #define NEXT_BLKP(bp) ((void *)(bp) + GET_SIZE(((void *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((void *)(bp) - GET_SIZE(((void *)(bp) - DSIZE)))
 
-/* Given block ptr pb, compute address of its next and previous address */
-#define NEXT(bp) ((void *)(bp))
-#define PREV(bp) ((void *)(bp) + WSIZE)
+/* Convert between a block ptr and its 32-bit link: offset from the heap base in DSIZE units, 0 for NULL */
+#define TO_LINK(a, ptr) ((ptr) == NULL ? 0 : (uint32_t)(((char *)(ptr) - (a)->heap_base) >> ALIGN_LOG2))
+#define FROM_LINK(a, link) ((link) == 0 ? NULL : (void *)((a)->heap_base + ((size_t)(link) << ALIGN_LOG2)))
+#define LINK_RANGE ((size_t)UINT32_MAX << ALIGN_LOG2) /* heap bytes the links can reach */
+
+/* Given block ptr pb, compute address of its next and previous links */
+#define NEXT(bp) ((uint32_t *)(bp))
+#define PREV(bp) ((uint32_t *)(bp) + 1)
 
 /* Given block ptr bp, compute address of next and previous blocks in segrated lists */
-#define NEXT_PTR(bp) (*(void **)NEXT(bp))
-#define PREV_PTR(bp) (*(void **)PREV(bp))
+#define NEXT_PTR(a, bp) FROM_LINK(a, *NEXT(bp))
+#define PREV_PTR(a, bp) FROM_LINK(a, *PREV(bp))
+#define SET_NEXT(a, bp, ptr) (*NEXT(bp) = TO_LINK(a, ptr))
+#define SET_PREV(a, bp, ptr) (*PREV(bp) = TO_LINK(a, ptr))
+
+/* Given block ptr bp of the tree class, compute its tree node fields */
+#define LEFT(bp) (*(void **)(bp))
+#define RIGHT(bp) (*(void **)((void *)(bp) + WSIZE))
+#define PARENT(bp) (*(void **)((void *)(bp) + 2 * WSIZE))
+#define COLOR(bp) (*(size_t *)((void *)(bp) + 3 * WSIZE))
+#define RED 1
+#define BLACK 0
+#define IS_RED(bp) ((bp) != NULL && COLOR(bp) == RED)
+
+/* Order of tree nodes: by size, then by address */
+#define NODE_LESS(a, b) (GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b)) || \
+                         (GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b)) && (a) < (b)))
 
 // #define PUT_PTR(p, ptr) (*(size_t *)(p) = (size_t)(ptr))
 
+/* Build with -DTLSF=1 to use the two-level segregated fit engine */
+#ifndef TLSF
+#define TLSF 0
+#endif
+
+#define MSB(x) (sizeof(unsigned long) * 8 - 1 - __builtin_clzl(x)) /* index of the highest set bit */
+
+#if TLSF
+#define SL_LOG2 3 /* log2 of the number of second-level sub-classes */
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + ALIGN_LOG2)              /* blocks below 2^FL_SHIFT share first-level class 0 */
+#define FL_COUNT (sizeof(size_t) * 8 - FL_SHIFT + 1) /* first-level classes */
+#define CLASS_SIZE (FL_COUNT * SL_COUNT)
+#else
 #define CLASS_SIZE 20
+#define TREE_CLASS (CLASS_SIZE - 1) /* blocks larger than 2^(CLASS_SIZE - 2) are kept in a red-black tree */
+#endif
+
+/* Build with -DCLASS_TABLE=1 to take the classes of blocks up to CLASS_TABLE_MAX bytes from class_table
+   in classes.h, which the sizeclass tool generates from traces. It gives the hot sizes exact classes */
+#ifndef CLASS_TABLE
+#define CLASS_TABLE 0
+#endif
+#if CLASS_TABLE && !TLSF
+#include "classes.h"
+_Static_assert((1 << (TABLE_CLASSES - 1)) == CLASS_TABLE_MAX && TABLE_CLASSES < TREE_CLASS,
+               "class_table must end at a power-of-two class below the tree class");
+#endif
+
+/* Placement policies of the segregated lists, set by mm_set_fit or the MM_FIT environment variable.
+   The tree class is always best fit, and a TLSF build always takes the head of a large enough class */
+#define FIT_GOOD 0    /* an exact fit, else the last larger block of the class */
+#define FIT_FIRST 1   /* the first block of the class that fits */
+#define FIT_BEST 2    /* the smallest fit among the blocks probed, stopping after fit_limit probes */
+#define FIT_ADDRESS 3 /* the lowest addressed block of the class that fits */
+#define FIT_NEXT 4    /* the first fit from where the last search of the class stopped */
+#define FIT_LIMIT 8   /* default probe limit of FIT_BEST */
+
+/* Address-ordered lists, chosen by mm_set_ordered, keep each list sorted by address instead of LIFO.
+   The heap is cut into SKIP_CHUNKS chunks, and each class records its lowest block in every chunk,
+   with a bitmap of the chunks that have one, so that an insertion only walks the blocks of one chunk */
+#define SKIP_CHUNKS 128
+#define SKIP_WORD (sizeof(unsigned long) * 8)
+#define SKIP_MIN_LOG2 12 /* smallest chunk: a page */
+#define SKIP_CHUNK(a, bp) ((size_t)((char *)(bp) - (a)->heap_base) >> (a)->skip_log2)
+
+/* Slab tier: requests up to SLAB_MAX bytes (sizeclass.h) get a header-free slot in a SLAB_SIZE-aligned page.
+   Build with -DSLAB=0 to send them through the boundary-tag path instead */
+#ifndef SLAB
+#define SLAB 1
+#endif
+#define SLAB_LOG2 12
+#define SLAB_SIZE (1 << SLAB_LOG2)
+#define SLAB_CLASSES (SLAB_MAX / DSIZE)
+#define SLAB_HDR ((sizeof(slab_t) + (DSIZE - 1)) & ~(DSIZE - 1))
+
+/* Given a slot ptr p, compute its slab and the index of its page in slab_map */
+#define SLABP(p) ((slab_t *)((size_t)(p) & ~(size_t)(SLAB_SIZE - 1)))
+#define PAGE_INDEX(a, p) (((size_t)(p) >> SLAB_LOG2) - (a)->slab_base)
+
+/* Build with -DREALLOC_SLACK=1 to have a block that realloc grew before reserve half the new size again
+   when it grows, so that repeated growth stays amortized O(1) at some cost in utilization */
+#ifndef REALLOC_SLACK
+#define REALLOC_SLACK 0
+#endif
+#define SLACK_SIZE(size) (REALLOC_SLACK && (size) <= (size_t)-1 / 4 ? (size) + (size) / 2 : (size))
+
+/* Quick lists: freed blocks of up to QUICK_MAX bytes (sizeclass.h) are kept allocated on exact-size LIFO lists, and coalesced
+   in batch when a list overflows or no fit is found. Build with -DQUICK=0 to coalesce on every free */
+#ifndef QUICK
+#define QUICK 1
+#endif
+#define QUICK_COUNT 32
+#define QUICK_FLUSH (1 << 16) /* freeing a block this large coalesces the quick lists, so the heap can be trimmed */
+#define QUICK_BIN(size) (((size) - MIN_BLOCK) / DSIZE)
+#define QUICK_BINS (QUICK_BIN(QUICK_MAX) + 1)
+_Static_assert(QUICK_BINS <= 64, "quick_map needs a bit per quick bin");
+
+/* mm_free_batch sorts and frees a local copy of this many pointers at a time */
+#define FREE_RUN 64
+
+typedef struct slab
+{
+    struct slab *next; /* next and previous partial slab of the same class */
+    struct slab *prev;
+    void *free;        /* freed slots, linked through their first word */
+    char *bump;        /* first slot never handed out */
+    unsigned int size; /* slot size */
+    unsigned int used; /* slots in use */
+    unsigned int capacity;
+} slab_t;
+
+/* Build with -DTHREADS=1 for a thread-safe allocator: ARENAS locked arenas and a per-thread cache of freed blocks */
+#ifndef THREADS
+#define THREADS 0
+#endif
+#if THREADS
+#define ARENAS 8
+#define ARENA_HEAP mem_region_maxsize(mem_default_region()) /* region size of each arena but the first, which uses the default heap */
+#define TCACHE_MAX 512              /* largest block size kept in a thread cache */
+#define TCACHE_COUNT 8              /* blocks kept per bin */
+#define TCACHE_BINS (SLAB_CLASSES + TCACHE_MAX / DSIZE + 1)
+#define LOCK(a) arena_lock(a)
+#define UNLOCK(a) pthread_mutex_unlock(&(a)->lock)
+#else
+#define ARENAS 1
+#define LOCK(a)
+#define UNLOCK(a)
+#endif
+
+/* Chunk index of address-ordered lists, allocated by arena_init only for them */
+typedef struct skip_index
+{
+    void *tail[CLASS_SIZE];                                 /* last block of each list */
+    uint32_t head[CLASS_SIZE][SKIP_CHUNKS];                 /* link of the lowest block of each class in each chunk */
+    unsigned long map[CLASS_SIZE][SKIP_CHUNKS / SKIP_WORD]; /* bit c is set iff head[i][c] is not 0 */
+} skip_index_t;
+
+/* An arena is also the mm_ctx_t of the context API */
+typedef struct mm_ctx
+{
+    mem_region_t *region;
+    char *heap_base;  /* origin of free-list links */
+    char *heap_limit; /* end of the address range of the region */
+    void *heap_listp;
+    void *heap_end_ptr;
+    void *free_list[CLASS_SIZE];
+#if !TLSF
+    void *rover[CLASS_SIZE]; /* where the next FIT_NEXT search of each class starts */
+#endif
+    struct skip_index *skip; /* index of address-ordered lists, fixed at arena_init; NULL for LIFO lists */
+    size_t skip_log2;        /* log2 of the chunk size */
+#if TLSF
+    unsigned long fl_map;          /* bit f is set iff sl_map[f] is non-zero */
+    unsigned int sl_map[FL_COUNT]; /* bit s of sl_map[f] is set iff free_list[f * SL_COUNT + s] is non-empty */
+#else
+    unsigned int class_map; /* bit i is set iff free_list[i] is non-empty */
+#endif
+    slab_t *slab_list[SLAB_CLASSES];             /* slabs with a free slot */
+    unsigned char *slab_map; /* bit n is set iff heap page n is a slab, sized by arena_init for the whole heap */
+    size_t slab_pages;       /* heap pages slab_map covers */
+    size_t slab_dirty;       /* bytes of slab_map that may have a bit set */
+    size_t slab_base;        /* page number of the first heap page */
+    void *quick_list[QUICK_BINS];                /* freed blocks, linked through their first word */
+    unsigned char quick_count[QUICK_BINS];
+    uint64_t quick_map;      /* bit i is set iff quick_list[i] is non-empty */
+#if STATS
+    struct mm_counters stats; /* counted under the arena lock */
+#endif
+#if THREADS
+    pthread_mutex_t lock;
+    void *remote_free;          /* blocks freed by threads of other arenas, linked through their first word */
+    unsigned long locks;        /* lock acquisitions */
+    unsigned long contended;    /* acquisitions that had to wait */
+    unsigned long remote_frees; /* blocks taken from remote_free */
+#endif
+} arena_t;
+
+/* A chunk of a bump allocator, a block of its heap whose payload follows this header */
+typedef struct bump_chunk
+{
+    struct bump_chunk *next; /* next chunk to carve, in the order they were first used */
+    char *end;               /* end of the payload */
+} bump_chunk_t;
+#define BUMP_HDR ALIGN(sizeof(bump_chunk_t))
+#define BUMP_PAYLOAD(c) ((char *)(c) + BUMP_HDR)
+
+struct mm_arena
+{
+    mm_ctx_t *ctx;       /* heap the chunks come from */
+    size_t chunk_size;   /* payload bytes of a regular chunk */
+    bump_chunk_t *first; /* first chunk, where a reset starts carving again */
+    bump_chunk_t *cur;   /* chunk being carved */
+    char *ptr;           /* next free byte of cur */
+    char *end;           /* end of cur */
+};
+
+#if THREADS
+typedef struct tcache
+{
+    arena_t *arena;                    /* arena of the thread */
+    unsigned int epoch;                /* heap_epoch the cached blocks belong to */
+    void *bins[TCACHE_BINS];           /* freed blocks, linked through their first word */
+    unsigned char counts[TCACHE_BINS]; /* blocks in each bin */
+} tcache_t;
+#endif
 
 // https://github.com/hehozo/Malloc-lab/blob/master/mm.c
 // https://github.com/lsw8075/malloc-lab/blob/master/src/mm.c
 
-static void *heap_listp;
-static void *heap_end_ptr;
-static void *free_list[CLASS_SIZE];
+static arena_t arenas[ARENAS];
+static int fit_policy = FIT_GOOD;
+static size_t fit_limit = FIT_LIMIT;
+static int fit_chosen; /* set once a policy is chosen, by mm_set_fit or from MM_FIT */
+static int ordered_lists; /* arenas initialized from now on keep address-ordered lists */
+#if STATS
+static struct mm_counters shared_stats; /* events of the default heap counted outside an arena lock */
+#endif
+#if THREADS
+static size_t narenas;           /* arenas in use, published after their region is set up */
+static size_t next_arena;        /* arena of the next new thread, modulo ARENAS */
+static unsigned int heap_epoch;  /* bumped by mm_init, invalidating thread caches */
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key; /* flushes the thread cache on thread exit */
+static __thread tcache_t tcache;
+#else
+#define arena_of(p) (MMAP_THRESHOLD && ((char *)(p) < arenas[0].heap_base || (char *)(p) >= arenas[0].heap_limit) \
+                         ? NULL                                                                                  \
+                         : &arenas[0])
+#endif
 
-static void *coalesce(void *);
-static void *extend_heap(size_t);
-static void *find_fit(size_t);
-static void place(void *, size_t);
-static void push_block(void *);
-static void pop_block(void *);
+static void *coalesce(arena_t *, void *);
+static void *extend_heap(arena_t *, size_t);
+static void *find_fit(arena_t *, size_t);
+#if !TLSF
+static void *list_fit(arena_t *, size_t, size_t);
+#endif
+static void place(arena_t *, void *, size_t);
+static void push_block(arena_t *, void *);
+static void pop_block(arena_t *, void *);
+static void push_ordered(arena_t *, void *, size_t);
+static void *skip_next(arena_t *, size_t, size_t);
+static size_t class_index(size_t);
+static void mark_class(arena_t *, size_t);
+static void clear_class(arena_t *, size_t);
+#if !TLSF
+static void *tree_fit(arena_t *, size_t);
+static void tree_insert(arena_t *, void *);
+static void tree_delete(arena_t *, void *);
+static void tree_delete_fixup(arena_t *, void *, void *);
+static void tree_transplant(arena_t *, void *, void *);
+static void rotate_left(arena_t *, void *);
+static void rotate_right(arena_t *, void *);
+#endif
+static void *get_block(arena_t *, size_t);
+static void *alloc_aligned(arena_t *, size_t, size_t);
+static void free_block(arena_t *, void *);
+static void trim_heap(arena_t *, void *);
+static int quick_put(arena_t *, void *, size_t);
+static void quick_flush(arena_t *, size_t);
+static int quick_flush_all(arena_t *);
+static int is_slab(arena_t *, void *);
+static void *slab_alloc(arena_t *, size_t);
+static void slab_free(arena_t *, void *);
+static void slab_link(arena_t *, slab_t *);
+static void slab_unlink(arena_t *, slab_t *);
+static int arena_init(arena_t *);
+static void *arena_malloc(arena_t *, size_t);
+static void *arena_calloc(arena_t *, size_t, int *);
+static void arena_free(arena_t *, void *, size_t);
+static size_t arena_malloc_batch(arena_t *, size_t, size_t, void **);
+static void arena_free_batch(arena_t *, void **, size_t);
+static void carve(arena_t *, void *, size_t, size_t, void **);
+static void sort_ptrs(void **, size_t);
+static void free_sorted(void **, size_t);
+static void *resize_block(arena_t *, void *, size_t);
+static size_t usable_size(arena_t *, void *);
+static size_t grow_size(arena_t *, void *, size_t);
+static void mark_grown(void *);
+static void *map_block(size_t);
+static void *remap_block(void *, size_t);
+static void unmap_block(void *);
+#if THREADS
+static arena_t *arena_of(void *);
+static void arena_lock(arena_t *);
+static arena_t *arena_assign(void);
+static tcache_t *thread_cache(void);
+static void tcache_flush(void *);
+static void tcache_key_create(void);
+static size_t tcache_bin(size_t);
+static void *tcache_get(tcache_t *, size_t);
+static int tcache_put(tcache_t *, void *, size_t);
+static void remote_push(arena_t *, void *);
+static void remote_drain(arena_t *);
+#endif
 
-static void *coalesce(void *bp)
+static void *coalesce(arena_t *a, void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
     size_t alloc = GET_ALLOC(HDRP(bp));
 
     if (alloc)
         return NULL;
-    else if (prev_alloc && next_alloc)
+
+    /* The merged block is zero only if all of its parts are */
+    size_t zero = GET_ZERO(HDRP(bp));
+    if (!prev_alloc)
+        zero &= GET_ZERO(HDRP(PREV_BLKP(bp)));
+    if (!next_alloc)
+        zero &= GET_ZERO(HDRP(NEXT_BLKP(bp)));
+
+    if (prev_alloc && next_alloc)
         return bp;
-    else if (prev_alloc && !next_alloc)
+    STAT_INC(a, coalesces);
+    if (prev_alloc && !next_alloc)
     {
-        pop_block(bp);
-        pop_block(NEXT_BLKP(bp));
+        pop_block(a, bp);
+        pop_block(a, NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 1, 0) | zero);
         PUT(HDRP(NEXT_BLKP(bp)), 0);
         PUT(FTRP(bp), 0);
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, 1, 0) | zero);
     }
     else if (!prev_alloc && next_alloc)
     {
-        pop_block(bp);
-        pop_block(PREV_BLKP(bp));
+        pop_block(a, bp);
+        pop_block(a, PREV_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 1, 0) | zero);
         PUT(HDRP(bp), 0);
         bp = PREV_BLKP(bp);
         PUT(FTRP(bp), 0);
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, 1, 0) | zero);
     }
     else
     {
-        pop_block(bp);
-        pop_block(PREV_BLKP(bp));
-        pop_block(NEXT_BLKP(bp));
+        pop_block(a, bp);
+        pop_block(a, PREV_BLKP(bp));
+        pop_block(a, NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 1, 0) | zero);
         PUT(HDRP(NEXT_BLKP(bp)), 0);
         PUT(FTRP(bp), 0);
         PUT(HDRP(bp), 0);
         bp = PREV_BLKP(bp);
         PUT(FTRP(bp), 0);
-        PUT(HDRP(bp), PACK(size, 0));
-        pop_block(bp);
+        PUT(HDRP(bp), PACK(size, 1, 0) | zero);
     }
-    push_block(bp);
+    /* The block before a coalesced free block is always allocated */
+    push_block(a, bp);
 
     return bp;
 }
 
-static void *extend_heap(size_t size)
+static void *extend_heap(arena_t *a, size_t size)
 {
     void *bp;
+    void *fresh = mem_region_fresh(a->region);
 
-    if ((long)(bp = mem_sbrk(size)) == -1)
+    if (size > LINK_RANGE - mem_region_heapsize(a->region))
         return NULL;
+    if ((long)(bp = mem_region_sbrk(a->region, size)) == -1)
+        return NULL;
+    STAT_INC(a, extends);
+    STAT_ADD(a, extend_bytes, size);
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
-    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
-    heap_end_ptr = NEXT_BLKP(bp);
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t zero = bp >= fresh ? 0x4 : 0;
+    PUT(HDRP(bp), PACK(size, prev_alloc, 0) | zero); /* Free block header */
+    PUT(FTRP(bp), PACK(size, prev_alloc, 0) | zero); /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));  /* New epilogue header */
+    a->heap_end_ptr = NEXT_BLKP(bp);
 
-    push_block(bp);
+    push_block(a, bp);
 
     /* Coalesce if the previous block was free */
-    return coalesce(bp);
+    return coalesce(a, bp);
 }
 
-static void *find_fit(size_t asize)
+#if TLSF
+static void *find_fit(arena_t *a, size_t asize)
 {
-    for (size_t i = 0, size = asize - 1; i < CLASS_SIZE; i++, size >>= 1)
+    /* Round up to the next sub-class boundary so that any block of the found class fits */
+    if (asize >= (1 << FL_SHIFT))
+        asize += (1UL << (MSB(asize) - SL_LOG2)) - 1;
+
+    size_t index = class_index(asize);
+    size_t fl = index / SL_COUNT;
+    unsigned int sl_bits = a->sl_map[fl] & (~0u << (index % SL_COUNT));
+
+    STAT_INC(a, fit_calls);
+    if (sl_bits == 0)
     {
-        if (i < CLASS_SIZE - 1 && size > 1)
-            continue;
+        unsigned long fl_bits = fl + 1 < FL_COUNT ? a->fl_map & (~0UL << (fl + 1)) : 0;
+        if (fl_bits == 0)
+            return NULL;
+        fl = __builtin_ctzl(fl_bits);
+        sl_bits = a->sl_map[fl];
+    }
+    STAT_INC(a, fit_probes);
+    return a->free_list[fl * SL_COUNT + __builtin_ctz(sl_bits)];
+}
+#else
+static void *find_fit(arena_t *a, size_t asize)
+{
+    void *bp;
+
+    STAT_INC(a, fit_calls);
+
+    /* Only non-empty classes that can hold asize are visited */
+    for (unsigned int map = a->class_map & (~0u << class_index(asize)); map != 0; map &= map - 1)
+    {
+        size_t i = __builtin_ctz(map);
+        if (i == TREE_CLASS)
+            return tree_fit(a, asize);
+        if ((bp = list_fit(a, i, asize)) != NULL)
+            return bp;
+    }
+    return NULL;
+}
+
+/*
+ * list_fit - the block of free_list[i] of at least asize bytes that the fit policy picks, or NULL
+ */
+static void *list_fit(arena_t *a, size_t i, size_t asize)
+{
+    void *fit = NULL;
+    size_t probes = 0;
+
+    switch (fit_policy)
+    {
+    case FIT_NEXT:
+        /* From the rover to the end of the list, then from the head up to the rover */
+        for (int pass = 0; pass < 2 && fit == NULL; pass++)
+        {
+            void *start = pass == 0 && a->rover[i] != NULL ? a->rover[i] : a->free_list[i];
+            void *stop = pass == 0 ? NULL : a->rover[i];
+            for (void *bp = start; bp != stop; bp = NEXT_PTR(a, bp))
+            {
+                STAT_INC(a, fit_probes);
+                if (GET_SIZE(HDRP(bp)) >= asize)
+                {
+                    fit = bp;
+                    break;
+                }
+            }
+            if (a->rover[i] == NULL)
+                break;
+        }
+        a->rover[i] = fit; /* pop_block moves it on to the next block */
+        return fit;
 
-        void *tmp = NULL;
-        for (void *bp = free_list[i]; bp != NULL; bp = NEXT_PTR(bp))
+    default:
+        for (void *bp = a->free_list[i]; bp != NULL; bp = NEXT_PTR(a, bp))
         {
             size_t free_size = GET_SIZE(HDRP(bp));
-            if (free_size == asize)
+            STAT_INC(a, fit_probes);
+            probes++;
+            if (free_size == asize && fit_policy != FIT_ADDRESS)
                 return bp;
-            else if (free_size > asize)
-                tmp = bp;
+            if (free_size > asize)
+            {
+                if (fit_policy == FIT_FIRST)
+                    return bp;
+                if (fit == NULL || (fit_policy == FIT_GOOD && a->skip == NULL) ||
+                    (fit_policy == FIT_BEST && free_size < GET_SIZE(HDRP(fit))) ||
+                    (fit_policy == FIT_ADDRESS && bp < fit))
+                    fit = bp;
+            }
+            else if (free_size == asize && (fit == NULL || bp < fit))
+                fit = bp;
+            if (fit_policy == FIT_BEST && fit != NULL && probes >= fit_limit)
+                break;
         }
-        if (tmp != NULL)
-            return tmp;
+        return fit;
     }
-    return NULL;
 }
+#endif
 
-static void place(void *bp, size_t asize)
+static void place(arena_t *a, void *bp, size_t asize)
 {
     size_t csize = GET_SIZE(HDRP(bp));
-    pop_block(bp);
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t zero = GET_ZERO(HDRP(bp));
+    pop_block(a, bp);
 
-    if ((csize - asize) >= (2 * DSIZE))
+    if ((csize - asize) >= MIN_BLOCK)
     {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        STAT_INC(a, splits);
+        PUT(HDRP(bp), PACK(asize, prev_alloc, 1));
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize - asize, 0));
-        PUT(FTRP(bp), PACK(csize - asize, 0));
-        push_block(bp);
+        PUT(HDRP(bp), PACK(csize - asize, 1, 0) | zero);
+        PUT(FTRP(bp), PACK(csize - asize, 1, 0) | zero);
+        CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        push_block(a, bp);
     }
     else
     {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT(HDRP(bp), PACK(csize, prev_alloc, 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     }
 }
 
-static void push_block(void *bp)
+static void push_block(arena_t *a, void *bp)
 {
-    size_t index = 0;
-    for (size_t size = GET_SIZE(HDRP(bp)) - 1; size > 0 && index < CLASS_SIZE - 1; index++, size >>= 1)
-        ;
+    size_t index = class_index(GET_SIZE(HDRP(bp)));
+
+#if !TLSF
+    if (index == TREE_CLASS)
+    {
+        tree_insert(a, bp);
+        mark_class(a, index);
+        return;
+    }
+#endif
+
+    if (a->skip != NULL)
+    {
+        push_ordered(a, bp, index);
+        mark_class(a, index);
+        return;
+    }
 
     // LIFO strategy
-    PUT(PREV(bp), &free_list[index]);
-    PUT(NEXT(bp), free_list[index]);
-    if (free_list[index])
-        PUT(PREV(free_list[index]), bp);
-    free_list[index] = bp;
+    SET_PREV(a, bp, NULL);
+    SET_NEXT(a, bp, a->free_list[index]);
+    if (a->free_list[index])
+        SET_PREV(a, a->free_list[index], bp);
+    a->free_list[index] = bp;
+    mark_class(a, index);
 }
 
-static void pop_block(void *bp)
+static void pop_block(arena_t *a, void *bp)
 {
     if (GET_ALLOC(HDRP(bp)))
         return;
-    void *prev = GET(PREV(bp));
-    void *next = GET(NEXT(bp));
+    size_t index = class_index(GET_SIZE(HDRP(bp)));
+#if !TLSF
+    if (index == TREE_CLASS)
+    {
+        tree_delete(a, bp);
+        if (a->free_list[TREE_CLASS] == NULL)
+            clear_class(a, TREE_CLASS);
+        return;
+    }
+#endif
+    void *prev = PREV_PTR(a, bp);
+    void *next = NEXT_PTR(a, bp);
+#if !TLSF
+    if (a->rover[index] == bp)
+        a->rover[index] = next;
+#endif
+    if (a->skip != NULL)
+    {
+        /* The chunk's lowest block passes the mark to the next block if it is in the same chunk */
+        size_t c = SKIP_CHUNK(a, bp);
+        if (FROM_LINK(a, a->skip->head[index][c]) == bp)
+        {
+            if (next != NULL && SKIP_CHUNK(a, next) == c)
+                a->skip->head[index][c] = TO_LINK(a, next);
+            else
+            {
+                a->skip->head[index][c] = 0;
+                a->skip->map[index][c / SKIP_WORD] &= ~(1UL << (c % SKIP_WORD));
+            }
+        }
+        if (a->skip->tail[index] == bp)
+            a->skip->tail[index] = prev;
+    }
     if (prev != NULL)
-        PUT(NEXT(PREV_PTR(bp)), next);
+        SET_NEXT(a, prev, next);
+    else if ((a->free_list[index] = next) == NULL)
+        clear_class(a, index);
     if (next != NULL)
-        PUT(PREV(NEXT_PTR(bp)), prev);
-    PUT(PREV(bp), 0);
-    PUT(NEXT(bp), 0);
+        SET_PREV(a, next, prev);
+    SET_PREV(a, bp, NULL);
+    SET_NEXT(a, bp, NULL);
 }
 
 /*
- * mm_init - initialize the malloc package.
+ * push_ordered - insert a block into the address-ordered list of its class. The blocks before and after
+ *     it are found from the chunk marks: within its own chunk, or as the lowest block of the next marked chunk.
  */
-int mm_init(void)
+static void push_ordered(arena_t *a, void *bp, size_t index)
 {
-    for (size_t i = 0; i < CLASS_SIZE; i++)
-        free_list[i] = NULL;
+    size_t c = SKIP_CHUNK(a, bp);
+    void *head = FROM_LINK(a, a->skip->head[index][c]);
+    void *prev, *next;
 
-    /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
-        return -1;
-    PUT(heap_listp, 0);
-    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp + (3 * WSIZE), PACK(0, 1));
-    heap_listp += 2 * WSIZE;
-    heap_end_ptr = NEXT_BLKP(heap_listp);
+    if (head != NULL && head < bp)
+    {
+        /* Walk the blocks of this chunk, which are consecutive in the list */
+        for (prev = head; (next = NEXT_PTR(a, prev)) != NULL && next < bp;)
+            prev = next;
+    }
+    else
+    {
+        /* bp becomes the lowest block of its chunk */
+        next = head != NULL ? head : skip_next(a, index, c + 1);
+        prev = next != NULL ? PREV_PTR(a, next) : a->skip->tail[index];
+        a->skip->head[index][c] = TO_LINK(a, bp);
+        a->skip->map[index][c / SKIP_WORD] |= 1UL << (c % SKIP_WORD);
+    }
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNCKSIZE) == NULL)
-        return -1;
-    return 0;
+    SET_PREV(a, bp, prev);
+    SET_NEXT(a, bp, next);
+    if (prev != NULL)
+        SET_NEXT(a, prev, bp);
+    else
+        a->free_list[index] = bp;
+    if (next != NULL)
+        SET_PREV(a, next, bp);
+    else
+        a->skip->tail[index] = bp;
 }
 
 /*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+ * skip_next - the lowest block of class index in the first marked chunk from chunk c on, or NULL
  */
-void *mm_malloc(size_t size)
+static void *skip_next(arena_t *a, size_t index, size_t c)
 {
-    void *bp;
+    while (c < SKIP_CHUNKS)
+    {
+        unsigned long bits = a->skip->map[index][c / SKIP_WORD] & (~0UL << (c % SKIP_WORD));
+        if (bits != 0)
+            return FROM_LINK(a, a->skip->head[index][c / SKIP_WORD * SKIP_WORD + __builtin_ctzl(bits)]);
+        c = (c / SKIP_WORD + 1) * SKIP_WORD;
+    }
+    return NULL;
+}
 
-    /* Ignore spurious requests */
-    if (size == 0)
-        return NULL;
+#if TLSF
+/*
+ * class_index - flattened (first-level, second-level) class of a block size.
+ *     The first level is the power of two below size, the second level splits it linearly.
+ */
+static size_t class_index(size_t size)
+{
+    if (size < (1 << FL_SHIFT))
+        return size >> ALIGN_LOG2;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    size_t asize = ASIZE(size);
+    size_t fl = MSB(size);
+    size_t sl = (size >> (fl - SL_LOG2)) ^ SL_COUNT;
+    return (fl - FL_SHIFT + 1) * SL_COUNT + sl;
+}
 
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL)
+static void mark_class(arena_t *a, size_t index)
+{
+    a->sl_map[index / SL_COUNT] |= 1u << (index % SL_COUNT);
+    a->fl_map |= 1UL << (index / SL_COUNT);
+}
+
+static void clear_class(arena_t *a, size_t index)
+{
+    if ((a->sl_map[index / SL_COUNT] &= ~(1u << (index % SL_COUNT))) == 0)
+        a->fl_map &= ~(1UL << (index / SL_COUNT));
+}
+#else
+/*
+ * class_index - index n of the class holding blocks of 2^(n-1) + 1 to 2^n bytes,
+ *     i.e. the bit length of (size - 1) taken with count-leading-zeros.
+ */
+static size_t class_index(size_t size)
+{
+#if CLASS_TABLE
+    if (size <= CLASS_TABLE_MAX)
+        return class_table[size / DSIZE];
+#endif
+    size_t index = size > 1 ? MSB(size - 1) + 1 : 0;
+    return index < CLASS_SIZE ? index : CLASS_SIZE - 1;
+}
+
+static void mark_class(arena_t *a, size_t index)
+{
+    a->class_map |= 1u << index;
+}
+
+static void clear_class(arena_t *a, size_t index)
+{
+    a->class_map &= ~(1u << index);
+}
+#endif
+
+#if !TLSF
+/*
+ * tree_fit - best fit in the tree class: the smallest block of at least asize bytes,
+ *     the lowest addressed one among equal sizes
+ */
+static void *tree_fit(arena_t *a, size_t asize)
+{
+    void *fit = NULL;
+
+    for (void *bp = a->free_list[TREE_CLASS]; bp != NULL;)
     {
-        place(bp, asize);
-        return bp;
+        STAT_INC(a, fit_probes);
+        if (GET_SIZE(HDRP(bp)) >= asize)
+        {
+            fit = bp;
+            bp = LEFT(bp);
+        }
+        else
+            bp = RIGHT(bp);
+    }
+    return fit;
+}
+
+static void tree_insert(arena_t *a, void *bp)
+{
+    void *parent = NULL;
+
+    for (void *cur = a->free_list[TREE_CLASS]; cur != NULL; cur = NODE_LESS(bp, cur) ? LEFT(cur) : RIGHT(cur))
+        parent = cur;
+
+    LEFT(bp) = NULL;
+    RIGHT(bp) = NULL;
+    PARENT(bp) = parent;
+    COLOR(bp) = RED;
+    if (parent == NULL)
+        a->free_list[TREE_CLASS] = bp;
+    else if (NODE_LESS(bp, parent))
+        LEFT(parent) = bp;
+    else
+        RIGHT(parent) = bp;
+
+    /* Restore the red-black properties on the way up */
+    void *p;
+    while (IS_RED(p = PARENT(bp)))
+    {
+        void *g = PARENT(p);
+        if (p == LEFT(g))
+        {
+            void *u = RIGHT(g);
+            if (IS_RED(u))
+            {
+                COLOR(p) = BLACK;
+                COLOR(u) = BLACK;
+                COLOR(g) = RED;
+                bp = g;
+                continue;
+            }
+            if (bp == RIGHT(p))
+            {
+                rotate_left(a, p);
+                bp = p;
+                p = PARENT(bp);
+            }
+            COLOR(p) = BLACK;
+            COLOR(g) = RED;
+            rotate_right(a, g);
+        }
+        else
+        {
+            void *u = LEFT(g);
+            if (IS_RED(u))
+            {
+                COLOR(p) = BLACK;
+                COLOR(u) = BLACK;
+                COLOR(g) = RED;
+                bp = g;
+                continue;
+            }
+            if (bp == LEFT(p))
+            {
+                rotate_right(a, p);
+                bp = p;
+                p = PARENT(bp);
+            }
+            COLOR(p) = BLACK;
+            COLOR(g) = RED;
+            rotate_left(a, g);
+        }
+    }
+    COLOR(a->free_list[TREE_CLASS]) = BLACK;
+}
+
+static void tree_delete(arena_t *a, void *bp)
+{
+    void *x, *x_parent;
+    size_t removed_color = COLOR(bp);
+
+    if (LEFT(bp) == NULL)
+    {
+        x = RIGHT(bp);
+        x_parent = PARENT(bp);
+        tree_transplant(a, bp, x);
+    }
+    else if (RIGHT(bp) == NULL)
+    {
+        x = LEFT(bp);
+        x_parent = PARENT(bp);
+        tree_transplant(a, bp, x);
+    }
+    else
+    {
+        /* Replace bp with its successor y, the leftmost node of its right subtree */
+        void *y = RIGHT(bp);
+        while (LEFT(y) != NULL)
+            y = LEFT(y);
+        removed_color = COLOR(y);
+        x = RIGHT(y);
+        if (PARENT(y) == bp)
+            x_parent = y;
+        else
+        {
+            x_parent = PARENT(y);
+            tree_transplant(a, y, x);
+            RIGHT(y) = RIGHT(bp);
+            PARENT(RIGHT(y)) = y;
+        }
+        tree_transplant(a, bp, y);
+        LEFT(y) = LEFT(bp);
+        PARENT(LEFT(y)) = y;
+        COLOR(y) = COLOR(bp);
+    }
+    if (removed_color == BLACK)
+        tree_delete_fixup(a, x, x_parent);
+
+    LEFT(bp) = NULL;
+    RIGHT(bp) = NULL;
+    PARENT(bp) = NULL;
+    COLOR(bp) = 0;
+}
+
+/*
+ * tree_delete_fixup - restore the red-black properties after a black node was removed above x.
+ *     x may be NULL, so its parent is passed along.
+ */
+static void tree_delete_fixup(arena_t *a, void *x, void *x_parent)
+{
+    while (x != a->free_list[TREE_CLASS] && !IS_RED(x))
+    {
+        if (x == LEFT(x_parent))
+        {
+            void *w = RIGHT(x_parent);
+            if (IS_RED(w))
+            {
+                COLOR(w) = BLACK;
+                COLOR(x_parent) = RED;
+                rotate_left(a, x_parent);
+                w = RIGHT(x_parent);
+            }
+            if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w)))
+            {
+                COLOR(w) = RED;
+                x = x_parent;
+                x_parent = PARENT(x);
+                continue;
+            }
+            if (!IS_RED(RIGHT(w)))
+            {
+                COLOR(LEFT(w)) = BLACK;
+                COLOR(w) = RED;
+                rotate_right(a, w);
+                w = RIGHT(x_parent);
+            }
+            COLOR(w) = COLOR(x_parent);
+            COLOR(x_parent) = BLACK;
+            COLOR(RIGHT(w)) = BLACK;
+            rotate_left(a, x_parent);
+        }
+        else
+        {
+            void *w = LEFT(x_parent);
+            if (IS_RED(w))
+            {
+                COLOR(w) = BLACK;
+                COLOR(x_parent) = RED;
+                rotate_right(a, x_parent);
+                w = LEFT(x_parent);
+            }
+            if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w)))
+            {
+                COLOR(w) = RED;
+                x = x_parent;
+                x_parent = PARENT(x);
+                continue;
+            }
+            if (!IS_RED(LEFT(w)))
+            {
+                COLOR(RIGHT(w)) = BLACK;
+                COLOR(w) = RED;
+                rotate_left(a, w);
+                w = LEFT(x_parent);
+            }
+            COLOR(w) = COLOR(x_parent);
+            COLOR(x_parent) = BLACK;
+            COLOR(LEFT(w)) = BLACK;
+            rotate_right(a, x_parent);
+        }
+        x = a->free_list[TREE_CLASS];
     }
+    if (x != NULL)
+        COLOR(x) = BLACK;
+}
+
+/*
+ * tree_transplant - put the subtree rooted at v in the place of the subtree rooted at u
+ */
+static void tree_transplant(arena_t *a, void *u, void *v)
+{
+    void *parent = PARENT(u);
+
+    if (parent == NULL)
+        a->free_list[TREE_CLASS] = v;
+    else if (u == LEFT(parent))
+        LEFT(parent) = v;
+    else
+        RIGHT(parent) = v;
+    if (v != NULL)
+        PARENT(v) = parent;
+}
+
+static void rotate_left(arena_t *a, void *x)
+{
+    void *y = RIGHT(x);
+
+    RIGHT(x) = LEFT(y);
+    if (LEFT(y) != NULL)
+        PARENT(LEFT(y)) = x;
+    tree_transplant(a, x, y);
+    LEFT(y) = x;
+    PARENT(x) = y;
+}
+
+static void rotate_right(arena_t *a, void *x)
+{
+    void *y = LEFT(x);
+
+    LEFT(x) = RIGHT(y);
+    if (RIGHT(y) != NULL)
+        PARENT(RIGHT(y)) = x;
+    tree_transplant(a, x, y);
+    RIGHT(y) = x;
+    PARENT(x) = y;
+}
+#endif
+
+/*
+ * get_block - find a free block of at least asize bytes, extending the heap if there is none
+ */
+static void *get_block(arena_t *a, size_t asize)
+{
+    void *bp;
+
+    /* Search the free list for a fit */
+    if ((bp = find_fit(a, asize)) != NULL)
+        return bp;
+
+    /* Coalesce the quick lists and search again before growing the heap */
+    if (QUICK && quick_flush_all(a) && (bp = find_fit(a, asize)) != NULL)
+        return bp;
 
-    /* No fit found. Get more memory and place the block */
-    size_t last_block_size = GET_SIZE(FTRP(heap_end_ptr)) - DSIZE;
-    size_t last_block_alloc = 1 - GET_ALLOC(FTRP(heap_end_ptr));
-    size_t extendsize = asize - last_block_alloc * last_block_size;
+    /* No fit found. Get more memory */
+    size_t last_block_free = !GET_PREV_ALLOC(HDRP(a->heap_end_ptr));
+    size_t last_block_size = last_block_free ? GET_SIZE(HDRP(a->heap_end_ptr) - WSIZE) : 0;
+
+    /* find_fit may pass over a free last block that still fits (TLSF rounds the request up) */
+    if (last_block_size >= asize)
+        return PREV_BLKP(a->heap_end_ptr);
+    return extend_heap(a, MAX(asize - last_block_size, MIN_BLOCK));
+}
+
+/*
+ * alloc_aligned - allocate a block of asize bytes whose payload is a multiple of align.
+ *     The leading fragment is split off and returned to the free lists.
+ */
+static void *alloc_aligned(arena_t *a, size_t align, size_t asize)
+{
+    void *bp;
 
-    if ((bp = extend_heap(extendsize)) == NULL)
+    if ((bp = get_block(a, asize + align + MIN_BLOCK)) == NULL)
         return NULL;
-    place(bp, asize);
 
+    size_t lead = (align - (size_t)bp % align) % align;
+    if (lead != 0 && lead < MIN_BLOCK)
+        lead += align;
+    if (lead != 0)
+    {
+        size_t csize = GET_SIZE(HDRP(bp));
+        size_t zero = GET_ZERO(HDRP(bp));
+        pop_block(a, bp);
+        PUT(HDRP(bp), PACK(lead, 1, 0) | zero);
+        PUT(FTRP(bp), PACK(lead, 1, 0) | zero);
+        push_block(a, bp);
+        bp += lead;
+        PUT(HDRP(bp), PACK(csize - lead, 0, 0) | zero);
+        PUT(FTRP(bp), PACK(csize - lead, 0, 0) | zero);
+        push_block(a, bp);
+    }
+    place(a, bp, asize);
     return bp;
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * free_block - return an allocated block to the free lists
  */
-void mm_free(void *ptr)
+static void free_block(arena_t *a, void *bp)
 {
-    if (ptr == NULL)
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    PUT(HDRP(bp), PACK(size, prev_alloc, 0));
+    PUT(FTRP(bp), PACK(size, prev_alloc, 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    push_block(a, bp);
+    trim_heap(a, coalesce(a, bp));
+}
+
+/*
+ * trim_heap - give back all but TOP_PAD bytes of the free block bp
+ *     if it ends the heap and has reached TOP_PAD + TRIM_THRESHOLD bytes
+ */
+static void trim_heap(arena_t *a, void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t pad = MAX(ALIGN(TOP_PAD), CHUNCKSIZE);
+
+    if (TRIM_THRESHOLD == 0 || size < pad + TRIM_THRESHOLD || NEXT_BLKP(bp) != a->heap_end_ptr)
         return;
 
-    size_t size = GET_SIZE(HDRP(ptr));
+    /* The block before a coalesced free block is always allocated */
+    size_t zero = GET_ZERO(HDRP(bp));
+    pop_block(a, bp);
+    PUT(HDRP(bp), PACK(pad, 1, 0) | zero);
+    PUT(FTRP(bp), PACK(pad, 1, 0) | zero);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1)); /* New epilogue header */
+    a->heap_end_ptr = NEXT_BLKP(bp);
+    push_block(a, bp);
+    mem_region_sbrk(a->region, -(intptr_t)(size - pad));
+}
+
+/*
+ * quick_put - keep a freed block on the quick list of size bytes, coalescing the list first if it is full.
+ *     size is the block size or, from a sized free, a lower bound of it. Returns 0 if it is too large for the quick lists.
+ */
+static int quick_put(arena_t *a, void *bp, size_t size)
+{
+    if (size > QUICK_MAX)
+        return 0;
 
-    PUT(HDRP(ptr), PACK(size, 0));
-    PUT(FTRP(ptr), PACK(size, 0));
-    push_block(ptr);
-    coalesce(ptr);
+    size_t bin = QUICK_BIN(size);
+    if (REALLOC_SLACK)
+        PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), GET_PREV_ALLOC(HDRP(bp)), 1)); /* drop the grown bit */
+    if (a->quick_count[bin] == QUICK_COUNT)
+        quick_flush(a, bin);
+    *(void **)bp = a->quick_list[bin];
+    a->quick_list[bin] = bp;
+    a->quick_count[bin]++;
+    a->quick_map |= (uint64_t)1 << bin;
+    return 1;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * quick_flush - free and coalesce all blocks of a quick list
  */
-void *mm_realloc(void *ptr, size_t size)
+static void quick_flush(arena_t *a, size_t bin)
 {
-    size_t old_size = GET_SIZE(HDRP(ptr));
-    size_t asize = ASIZE(size);
-    size_t copy_size = size > old_size - DSIZE ? old_size - DSIZE : size;
+    void *bp = a->quick_list[bin];
 
-    if (ptr == NULL)
-        return mm_malloc(size);
-    if (size == 0)
+    a->quick_list[bin] = NULL;
+    a->quick_count[bin] = 0;
+    a->quick_map &= ~((uint64_t)1 << bin);
+    while (bp != NULL)
     {
-        mm_free(ptr);
-        return NULL;
+        void *next = *(void **)bp;
+        free_block(a, bp);
+        bp = next;
     }
+}
 
-    void *next_ptr = NEXT_BLKP(ptr);
-    size_t last = GET_SIZE(HDRP(next_ptr)) == 0 ||
-                  (GET_ALLOC(HDRP(next_ptr)) == 0 && GET_SIZE(HDRP(NEXT_BLKP(next_ptr))) == 0);
-    size_t free = find_fit(asize) == NULL;
+/*
+ * quick_flush_all - flush every quick list. Returns 0 if they were all empty.
+ */
+static int quick_flush_all(arena_t *a)
+{
+    if (a->quick_map == 0)
+        return 0;
 
-    if (old_size >= asize)
-    {
-        place(ptr, asize);
-        coalesce(NEXT_BLKP(ptr));
-        return ptr;
-    }
-    else if (free && last)
-    {
-        size_t extendsize = asize + DSIZE - GET_SIZE(HDRP(ptr)) - GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-        if (extend_heap(extendsize) == NULL)
-            return NULL;
-        pop_block(NEXT_BLKP(ptr));
+    for (uint64_t map = a->quick_map; map != 0; map &= map - 1)
+        quick_flush(a, __builtin_ctzll(map));
+    return 1;
+}
 
-        size_t total_size = GET_SIZE(HDRP(ptr)) + GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-        PUT(HDRP(ptr), PACK(total_size, 1));
-        PUT(FTRP(ptr), PACK(total_size, 1));
-        place(ptr, asize);
-        coalesce(NEXT_BLKP(ptr));
+static int is_slab(arena_t *a, void *p)
+{
+    size_t page = PAGE_INDEX(a, p);
+    return page < a->slab_pages && (a->slab_map[page / 8] >> (page % 8) & 1);
+}
 
-        return ptr;
-    }
-    else
+/*
+ * slab_alloc - take a slot of at least size bytes from a slab, creating the slab if its class has none
+ */
+static void *slab_alloc(arena_t *a, size_t size)
+{
+    size_t index = (size - 1) / DSIZE;
+    slab_t *sp = a->slab_list[index];
+    void *p;
+
+    if (sp == NULL)
     {
-        void *newptr = mm_malloc(size);
-        if (newptr == NULL)
+        if ((sp = alloc_aligned(a, SLAB_SIZE, ASIZE(SLAB_SIZE))) == NULL)
             return NULL;
+        size_t page = PAGE_INDEX(a, sp);
+        a->slab_map[page / 8] |= 1 << (page % 8);
+        a->slab_dirty = MAX(a->slab_dirty, page / 8 + 1);
+        sp->size = (index + 1) * DSIZE;
+        sp->capacity = (SLAB_SIZE - SLAB_HDR) / sp->size;
+        sp->used = 0;
+        sp->free = NULL;
+        sp->bump = (char *)sp + SLAB_HDR;
+        slab_link(a, sp);
+    }
 
-        memcpy(newptr, ptr, copy_size);
-        mm_free(ptr);
-        return newptr;
+    if ((p = sp->free) != NULL)
+        sp->free = *(void **)p;
+    else
+    {
+        p = sp->bump;
+        sp->bump += sp->size;
     }
-}
\ No newline at end of file
+    if (++sp->used == sp->capacity)
+        slab_unlink(a, sp);
+    return p;
+}
+
+/*
+ * slab_free - return a slot to its slab. An empty slab goes back to the heap
+ *     unless it is the last one of its class.
+ */
+static void slab_free(arena_t *a, void *p)
+{
+    slab_t *sp = SLABP(p);
+
+    *(void **)p = sp->free;
+    sp->free = p;
+    if (sp->used-- == sp->capacity)
+        slab_link(a, sp);
+    if (sp->used == 0 && (sp->next != NULL || sp->prev != NULL))
+    {
+        slab_unlink(a, sp);
+        a->slab_map[PAGE_INDEX(a, sp) / 8] &= ~(1 << (PAGE_INDEX(a, sp) % 8));
+        free_block(a, sp);
+    }
+}
+
+static void slab_link(arena_t *a, slab_t *sp)
+{
+    slab_t **head = &a->slab_list[sp->size / DSIZE - 1];
+
+    sp->prev = NULL;
+    sp->next = *head;
+    if (*head != NULL)
+        (*head)->prev = sp;
+    *head = sp;
+}
+
+static void slab_unlink(arena_t *a, slab_t *sp)
+{
+    if (sp->prev != NULL)
+        sp->prev->next = sp->next;
+    else
+        a->slab_list[sp->size / DSIZE - 1] = sp->next;
+    if (sp->next != NULL)
+        sp->next->prev = sp->prev;
+}
+
+/*
+ * arena_init - make the heap of an arena empty, over its region starting at the brk pointer
+ */
+static int arena_init(arena_t *a)
+{
+    for (size_t i = 0; i < CLASS_SIZE; i++)
+        a->free_list[i] = NULL;
+#if !TLSF
+    memset(a->rover, 0, sizeof(a->rover));
+#endif
+#if TLSF
+    a->fl_map = 0;
+    for (size_t i = 0; i < FL_COUNT; i++)
+        a->sl_map[i] = 0;
+#else
+    a->class_map = 0;
+#endif
+    for (size_t i = 0; i < SLAB_CLASSES; i++)
+        a->slab_list[i] = NULL;
+    memset(a->quick_list, 0, sizeof(a->quick_list));
+    memset(a->quick_count, 0, sizeof(a->quick_count));
+    a->quick_map = 0;
+    if (!ordered_lists)
+    {
+        free(a->skip);
+        a->skip = NULL;
+    }
+    else
+    {
+        /* Kept from the last arena_init if there is one, as the default heap is reset by every mm_init */
+        if (a->skip == NULL && (a->skip = malloc(sizeof(skip_index_t))) == NULL)
+            return -1;
+        memset(a->skip, 0, sizeof(skip_index_t));
+    }
+#if STATS
+    memset(&a->stats, 0, sizeof(a->stats));
+#endif
+    a->heap_base = mem_region_lo(a->region);
+    a->heap_limit = a->heap_base + mem_region_maxsize(a->region);
+    size_t span = MIN(mem_region_maxsize(a->region), LINK_RANGE);
+    for (a->skip_log2 = SKIP_MIN_LOG2; (span - 1) >> a->skip_log2 >= SKIP_CHUNKS; a->skip_log2++)
+        ;
+    a->slab_base = (size_t)a->heap_base >> SLAB_LOG2;
+    if (SLAB)
+    {
+        /* One bit per page of the heap the links can reach. A map kept from the last arena_init
+           is only cleared as far as slabs were made in it */
+        size_t pages = (span + SLAB_SIZE - 1) / SLAB_SIZE;
+        if (a->slab_map == NULL || a->slab_pages < pages)
+        {
+            free(a->slab_map);
+            if ((a->slab_map = calloc((pages + 7) / 8, 1)) == NULL)
+            {
+                a->slab_pages = 0;
+                return -1;
+            }
+            a->slab_pages = pages;
+        }
+        else
+            memset(a->slab_map, 0, a->slab_dirty);
+        a->slab_dirty = 0;
+    }
+#if THREADS
+    a->remote_free = NULL;
+    a->locks = a->contended = a->remote_frees = 0;
+#endif
+
+    /* Create the initial empty heap */
+    if ((a->heap_listp = mem_region_sbrk(a->region, 4 * WSIZE)) == (void *)-1)
+        return -1;
+    PUT(a->heap_listp, 0);
+    PUT(a->heap_listp + (1 * WSIZE), PACK(DSIZE, 1, 1));
+    PUT(a->heap_listp + (2 * WSIZE), PACK(DSIZE, 1, 1));
+    PUT(a->heap_listp + (3 * WSIZE), PACK(0, 1, 1));
+    a->heap_listp += 2 * WSIZE;
+    a->heap_end_ptr = NEXT_BLKP(a->heap_listp);
+
+    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(a, CHUNCKSIZE) == NULL)
+        return -1;
+    return 0;
+}
+
+static void *arena_malloc(arena_t *a, size_t size)
+{
+    void *bp;
+
+    /* Small requests are served by the slab tier first */
+    if (SLAB && size <= SLAB_MAX && (bp = slab_alloc(a, size)) != NULL)
+        return bp;
+
+    /* Adjust block size to include overhead and alignment reqs. */
+    size_t asize = ASIZE(size);
+
+    /* A quick list block of the exact size is already allocated */
+    if (QUICK && asize <= QUICK_MAX && (bp = a->quick_list[QUICK_BIN(asize)]) != NULL)
+    {
+        size_t bin = QUICK_BIN(asize);
+        if ((a->quick_list[bin] = *(void **)bp) == NULL)
+            a->quick_map &= ~((uint64_t)1 << bin);
+        a->quick_count[bin]--;
+        return bp;
+    }
+
+    /* Search the free list for a fit, or get more memory, and place the block */
+    if ((bp = get_block(a, asize)) == NULL)
+        return NULL;
+    place(a, bp, asize);
+
+    return bp;
+}
+
+/*
+ * arena_calloc - allocate a block of size bytes for calloc, setting *zeroed if its payload is already zero
+ */
+static void *arena_calloc(arena_t *a, size_t size, int *zeroed)
+{
+    void *bp;
+    size_t asize = ASIZE(size);
+
+    /* Slots and quick list blocks have been handed out before */
+    *zeroed = 0;
+    if ((SLAB && size <= SLAB_MAX) || (QUICK && asize <= QUICK_MAX && a->quick_list[QUICK_BIN(asize)] != NULL))
+        return arena_malloc(a, size);
+
+    if ((bp = get_block(a, asize)) == NULL)
+        return NULL;
+    size_t csize = GET_SIZE(HDRP(bp));
+    *zeroed = GET_ZERO(HDRP(bp)) != 0;
+    place(a, bp, asize);
+
+    /* A zero block may still hold its free-list links or tree node, and its footer if it was not split */
+    if (*zeroed)
+    {
+        memset(bp, 0, MIN(size, 4 * WSIZE));
+        if (csize - DSIZE < size)
+            PUT(bp + csize - DSIZE, 0);
+    }
+    return bp;
+}
+
+/*
+ * arena_free - free a block or slot. asize is the block size known to the caller, or 0 to read it from the header.
+ */
+static void arena_free(arena_t *a, void *ptr, size_t asize)
+{
+    if (SLAB && is_slab(a, ptr))
+        slab_free(a, ptr);
+    else if (!QUICK || !quick_put(a, ptr, asize != 0 ? asize : GET_SIZE(HDRP(ptr))))
+    {
+        if (QUICK && GET_SIZE(HDRP(ptr)) >= QUICK_FLUSH)
+            quick_flush_all(a);
+        free_block(a, ptr);
+    }
+}
+
+/*
+ * arena_malloc_batch - allocate up to n blocks of size bytes into out, carving them from one free block
+ *     where possible. Returns the number allocated.
+ */
+static size_t arena_malloc_batch(arena_t *a, size_t size, size_t n, void **out)
+{
+    size_t asize = ASIZE(size);
+    size_t i = 0;
+
+    /* Slots and quick list blocks are carved already */
+    while (i < n && ((SLAB && size <= SLAB_MAX) || (QUICK && asize <= QUICK_MAX && a->quick_list[QUICK_BIN(asize)] != NULL)))
+    {
+        if ((out[i] = arena_malloc(a, size)) == NULL)
+            return i;
+        i++;
+    }
+
+    /* One free block for all of them if there is one, else the fits for one at a time, and only then a larger heap */
+    int whole = 1;
+    while (i < n)
+    {
+        void *bp = NULL;
+        size_t total = MIN(n - i, (size_t)-1 / 2 / asize) * asize;
+        if (whole)
+            bp = find_fit(a, total);
+        whole = 0;
+        if (bp == NULL && (bp = find_fit(a, asize)) == NULL && (bp = get_block(a, total)) == NULL &&
+            (bp = get_block(a, asize)) == NULL)
+            break;
+
+        size_t k = MIN(n - i, GET_SIZE(HDRP(bp)) / asize);
+        carve(a, bp, asize, k, out + i);
+        i += k;
+    }
+    return i;
+}
+
+/*
+ * carve - split the free block bp into n allocated blocks of asize bytes, stored into out.
+ *     The last one is placed like a single block, giving the rest back to the free lists.
+ */
+static void carve(arena_t *a, void *bp, size_t asize, size_t n, void **out)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t zero = GET_ZERO(HDRP(bp));
+
+    pop_block(a, bp);
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        PUT(HDRP(bp), PACK(asize, prev_alloc, 1));
+        out[i] = bp;
+        bp = NEXT_BLKP(bp);
+        csize -= asize;
+        prev_alloc = 1;
+    }
+    PUT(HDRP(bp), PACK(csize, prev_alloc, 0) | zero);
+    PUT(FTRP(bp), PACK(csize, prev_alloc, 0) | zero);
+    push_block(a, bp);
+    place(a, bp, asize);
+    out[n - 1] = bp;
+}
+
+/*
+ * arena_free_batch - free n blocks of the arena sorted by address. A run of blocks that lie next to
+ *     each other is merged into one block first, so it is coalesced once.
+ */
+static void arena_free_batch(arena_t *a, void **ptrs, size_t n)
+{
+    for (size_t i = 0; i < n;)
+    {
+        void *bp = ptrs[i++];
+        if (SLAB && is_slab(a, bp))
+        {
+            slab_free(a, bp);
+            continue;
+        }
+
+        size_t size = GET_SIZE(HDRP(bp));
+        while (i < n && ptrs[i] == bp + size && !(SLAB && is_slab(a, ptrs[i])))
+            size += GET_SIZE(HDRP(ptrs[i++]));
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)), 1));
+        arena_free(a, bp, 0);
+    }
+}
+
+/*
+ * sort_ptrs - sort pointers by address. Insertion sort: runs are at most FREE_RUN long, and often in allocation order.
+ */
+static void sort_ptrs(void **ptrs, size_t n)
+{
+    for (size_t i = 1; i < n; i++)
+    {
+        void *p = ptrs[i];
+        size_t j = i;
+        for (; j > 0 && (char *)ptrs[j - 1] > (char *)p; j--)
+            ptrs[j] = ptrs[j - 1];
+        ptrs[j] = p;
+    }
+}
+
+/*
+ * resize_block - resize an allocated block to hold size bytes without copying it elsewhere:
+ *     in place, into its free neighbours, or into new heap space if it is the last block.
+ *     Returns the block, which moves down if it grew backwards, or NULL if it has to be copied.
+ */
+static void *resize_block(arena_t *a, void *ptr, size_t size)
+{
+    /* A slot is kept while the new size still fits */
+    if (SLAB && is_slab(a, ptr))
+        return size <= SLABP(ptr)->size ? ptr : NULL;
+
+    size_t old_size = GET_SIZE(HDRP(ptr));
+    size_t asize = ASIZE(size);
+    size_t gsize = ASIZE(grow_size(a, ptr, size));
+
+    if (old_size >= asize)
+    {
+        /* Slack left by an earlier growth is kept for the next one */
+        if (!GET_GROWN(HDRP(ptr)) || old_size - asize > asize / 2)
+        {
+            place(a, ptr, asize);
+            coalesce(a, NEXT_BLKP(ptr));
+        }
+        return ptr;
+    }
+
+    void *next = NEXT_BLKP(ptr);
+    size_t next_size = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    size_t prev_size = GET_PREV_ALLOC(HDRP(ptr)) ? 0 : GET_SIZE(HDRP(ptr) - WSIZE);
+
+    /* The last block grows by extending the heap, which merges the new space into its free successor */
+    if (old_size + next_size < asize && (next_size ? NEXT_BLKP(next) : next) == a->heap_end_ptr)
+    {
+        if (extend_heap(a, MAX(gsize - old_size - next_size, MIN_BLOCK)) == NULL)
+            return NULL;
+        next_size = GET_SIZE(HDRP(next));
+    }
+
+    /* Grow forward into the free next block */
+    if (old_size + next_size >= asize)
+    {
+        if (next_size != 0)
+            pop_block(a, next);
+        PUT(HDRP(ptr), PACK(old_size + next_size, GET_PREV_ALLOC(HDRP(ptr)), 1));
+        place(a, ptr, MIN(gsize, old_size + next_size));
+        if (REALLOC_SLACK)
+            SET_GROWN(HDRP(ptr));
+        return ptr;
+    }
+
+    /* Grow backward into the free previous block (and forward as well), moving the payload down */
+    if (prev_size != 0 && prev_size + old_size + next_size >= asize)
+    {
+        void *prev = PREV_BLKP(ptr);
+        size_t total = prev_size + old_size + next_size;
+
+        pop_block(a, prev);
+        if (next_size != 0)
+            pop_block(a, next);
+        PUT(HDRP(prev), PACK(total, 1, 1)); /* the block before a free block is allocated */
+        memmove(prev, ptr, old_size - WSIZE);
+        place(a, prev, MIN(gsize, total));
+        if (REALLOC_SLACK)
+            SET_GROWN(HDRP(prev));
+        return prev;
+    }
+    return NULL;
+}
+
+/*
+ * grow_size - size to reserve when growing ptr to size bytes: with slack if realloc grew it before
+ */
+static size_t grow_size(arena_t *a, void *ptr, size_t size)
+{
+    if (!REALLOC_SLACK || (SLAB && is_slab(a, ptr)) || !GET_GROWN(HDRP(ptr)))
+        return size;
+    return SLACK_SIZE(size);
+}
+
+/*
+ * mark_grown - mark a block that a growing realloc copied into
+ */
+static void mark_grown(void *ptr)
+{
+    arena_t *a = arena_of(ptr);
+
+    if (!REALLOC_SLACK || a == NULL || (SLAB && is_slab(a, ptr)))
+        return;
+    LOCK(a);
+    SET_GROWN(HDRP(ptr));
+    UNLOCK(a);
+}
+
+/*
+ * usable_size - payload bytes of an allocated block or slot, or of a direct-mapped block if a is NULL
+ */
+static size_t usable_size(arena_t *a, void *ptr)
+{
+    if (a == NULL)
+        return MAP_SIZE(ptr) - DSIZE;
+    if (SLAB && is_slab(a, ptr))
+        return SLABP(ptr)->size;
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * map_block - allocate a block of size bytes in a direct mapping of its own
+ */
+static void *map_block(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    char *p;
+
+    if (size > (size_t)-1 / 2)
+        return NULL;
+    size_t msize = (size + DSIZE + pagesize - 1) / pagesize * pagesize;
+    if ((p = mem_map(msize)) == NULL)
+        return NULL;
+    PUT(p, msize);
+    PUT(p + DSIZE - WSIZE, MAPPED_HDR);
+    return p + DSIZE;
+}
+
+/*
+ * remap_block - resize a direct-mapped block to size bytes, letting the kernel move it if it has to.
+ *     Returns NULL, keeping the block, if out of memory.
+ */
+static void *remap_block(void *bp, size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    char *p;
+
+    assert(GET(HDRP(bp)) == MAPPED_HDR);
+    if (size > (size_t)-1 / 2)
+        return NULL;
+    size_t msize = (size + DSIZE + pagesize - 1) / pagesize * pagesize;
+    if (msize == MAP_SIZE(bp))
+        return bp;
+    if ((p = mem_remap(bp - DSIZE, msize)) == NULL)
+        return NULL;
+    PUT(p, msize);
+    return p + DSIZE;
+}
+
+/*
+ * unmap_block - give a direct-mapped block back to the OS
+ */
+static void unmap_block(void *bp)
+{
+    assert(GET(HDRP(bp)) == MAPPED_HDR);
+    mem_unmap(bp - DSIZE);
+}
+
+#if THREADS
+/*
+ * arena_of - the arena whose region holds p, NULL for a direct-mapped block
+ */
+static arena_t *arena_of(void *p)
+{
+    size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+
+    for (size_t i = 0; i < n; i++)
+        if ((char *)p >= arenas[i].heap_base && (char *)p < arenas[i].heap_limit)
+            return &arenas[i];
+    return NULL;
+}
+
+static void arena_lock(arena_t *a)
+{
+    if (pthread_mutex_trylock(&a->lock) != 0)
+    {
+        pthread_mutex_lock(&a->lock);
+        a->contended++;
+    }
+    a->locks++;
+}
+
+/*
+ * arena_assign - bind the calling thread to the next arena in round-robin order,
+ *     creating the arena on first use. Falls back to the first arena if out of memory.
+ */
+static arena_t *arena_assign(void)
+{
+    arena_t *a = &arenas[0];
+
+    pthread_mutex_lock(&arenas_lock);
+    size_t i = next_arena++ % ARENAS;
+    if (i == narenas && (arenas[i].region = mem_region_create(ARENA_HEAP)) != NULL)
+    {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        if (arena_init(&arenas[i]) == 0)
+            __atomic_store_n(&narenas, i + 1, __ATOMIC_RELEASE);
+        else
+        {
+            mem_region_destroy(arenas[i].region);
+            arenas[i].region = NULL;
+        }
+    }
+    if (i < narenas)
+        a = &arenas[i];
+    pthread_mutex_unlock(&arenas_lock);
+    return a;
+}
+
+/*
+ * tcache_flush - give the blocks of a thread cache back to its arena
+ */
+static void tcache_flush(void *arg)
+{
+    tcache_t *tc = arg;
+
+    if (tc->epoch != heap_epoch)
+        return;
+    LOCK(tc->arena);
+    remote_drain(tc->arena);
+    for (size_t i = 0; i < TCACHE_BINS; i++)
+    {
+        while (tc->bins[i] != NULL)
+        {
+            void *bp = tc->bins[i];
+            tc->bins[i] = *(void **)bp;
+            arena_free(tc->arena, bp, 0);
+        }
+        tc->counts[i] = 0;
+    }
+    UNLOCK(tc->arena);
+}
+
+static void tcache_key_create(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * thread_cache - the cache of the calling thread, bound to an arena on first use
+ *     and emptied if mm_init reset the heap since
+ */
+static tcache_t *thread_cache(void)
+{
+    tcache_t *tc = &tcache;
+
+    if (tc->epoch != heap_epoch)
+    {
+        if (tc->arena == NULL)
+        {
+            pthread_once(&tcache_once, tcache_key_create);
+            pthread_setspecific(tcache_key, tc);
+            tc->arena = arena_assign();
+        }
+        memset(tc->bins, 0, sizeof(tc->bins));
+        memset(tc->counts, 0, sizeof(tc->counts));
+        tc->epoch = heap_epoch;
+    }
+    return tc;
+}
+
+/*
+ * tcache_bin - thread cache bin of a request of size bytes, TCACHE_BINS if it is not cached.
+ *     Slots are binned by slot size and blocks by block size, as a request gets either exactly.
+ */
+static size_t tcache_bin(size_t size)
+{
+    if (SLAB && size <= SLAB_MAX)
+        return (size - 1) / DSIZE;
+    if (size > TCACHE_MAX)
+        return TCACHE_BINS;
+
+    size_t asize = ASIZE(size);
+    return asize <= TCACHE_MAX ? SLAB_CLASSES + asize / DSIZE : TCACHE_BINS;
+}
+
+/*
+ * tcache_get - take a cached block for a request of size bytes, NULL if its bin is empty
+ */
+static void *tcache_get(tcache_t *tc, size_t size)
+{
+    size_t bin = tcache_bin(size);
+    void *bp;
+
+    if (bin == TCACHE_BINS || (bp = tc->bins[bin]) == NULL)
+        return NULL;
+    tc->bins[bin] = *(void **)bp;
+    tc->counts[bin]--;
+    return bp;
+}
+
+/*
+ * tcache_put - keep a freed block of the thread's own arena in its cache, if its bin has room.
+ *     asize is the block size known to the caller, or 0 to read it from the header.
+ */
+static int tcache_put(tcache_t *tc, void *ptr, size_t asize)
+{
+    size_t bin;
+    if (SLAB && is_slab(tc->arena, ptr))
+        bin = SLABP(ptr)->size / DSIZE - 1;
+    else
+    {
+        /* Only REALLOC_SLACK builds set the grown bit */
+        if (asize == 0)
+            asize = GET_SIZE(HDRP(ptr));
+        if (asize > TCACHE_MAX || (REALLOC_SLACK && GET_GROWN(HDRP(ptr))))
+            return 0;
+        bin = SLAB_CLASSES + asize / DSIZE;
+    }
+
+    if (tc->counts[bin] == TCACHE_COUNT)
+        return 0;
+    *(void **)ptr = tc->bins[bin];
+    tc->bins[bin] = ptr;
+    tc->counts[bin]++;
+    return 1;
+}
+
+/*
+ * remote_push - hand a block to its arena without taking the arena lock.
+ *     Any thread may push, only lock holders drain, so a single CAS suffices.
+ */
+static void remote_push(arena_t *a, void *ptr)
+{
+    void *head = __atomic_load_n(&a->remote_free, __ATOMIC_RELAXED);
+
+    do
+        *(void **)ptr = head;
+    while (!__atomic_compare_exchange_n(&a->remote_free, &head, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * remote_drain - free the blocks pushed by other threads, all taken at once (lock held)
+ */
+static void remote_drain(arena_t *a)
+{
+    if (__atomic_load_n(&a->remote_free, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    void *bp = __atomic_exchange_n(&a->remote_free, NULL, __ATOMIC_ACQUIRE);
+    while (bp != NULL)
+    {
+        void *next = *(void **)bp;
+        arena_free(a, bp, 0);
+        a->remote_frees++;
+        bp = next;
+    }
+}
+#endif
+
+/*
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void)
+{
+    arena_t *a = &arenas[0];
+    char *env;
+
+    /* The environment is read once, unless mm_set_fit came first */
+    if (!fit_chosen && (env = getenv("MM_FIT")) != NULL && mm_set_fit(env) < 0)
+    {
+        fprintf(stderr, "mm_init: unknown MM_FIT policy %s\n", env);
+        fit_chosen = 1;
+    }
+
+    if (a->region == NULL)
+    {
+        a->region = mem_default_region();
+#if THREADS
+        pthread_mutex_init(&a->lock, NULL);
+        narenas = 1;
+#endif
+    }
+#if THREADS
+    /* The other arenas start over too, and thread caches notice the new epoch */
+    for (size_t i = 1; i < narenas; i++)
+    {
+        mem_region_reset_brk(arenas[i].region);
+        if (arena_init(&arenas[i]) < 0)
+            return -1;
+    }
+    heap_epoch++;
+#endif
+    return arena_init(a);
+}
+
+/*
+ * mm_set_fit - Choose the placement policy of the free lists: "good" (the default), "first",
+ *     "best" or "best:<probes>", "address" or "next". Call it before mm_init. Returns -1 for
+ *     an unknown policy.
+ */
+int mm_set_fit(const char *policy)
+{
+    static const char *names[] = {"good", "first", "best", "address", "next"};
+    size_t len = strcspn(policy, ":");
+    char *end;
+
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+    {
+        if (strlen(names[i]) != len || strncmp(policy, names[i], len) != 0)
+            continue;
+        fit_limit = FIT_LIMIT;
+        if (policy[len] == ':')
+        {
+            if (i != FIT_BEST || (fit_limit = strtoul(policy + len + 1, &end, 10)) == 0 || *end != '\0')
+                return -1;
+        }
+        fit_policy = i;
+        fit_chosen = 1;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * mm_set_ordered - Keep the free lists of the heaps initialized from now on (by mm_init or mm_ctx_create)
+ *     in address order rather than LIFO. The first fit of a list is then the lowest addressed one.
+ */
+void mm_set_ordered(int ordered)
+{
+    ordered_lists = ordered;
+}
+
+/*
+ * mm_malloc - Allocate a block of at least size bytes, aligned to DSIZE.
+ *     Large requests get a mapping of their own; the rest try the thread cache
+ *     of a THREADS build, then the slab, quick lists and free lists of an arena,
+ *     and extend its heap only if none fits.
+ */
+void *mm_malloc(size_t size)
+{
+    void *bp;
+
+    /* Ignore spurious requests */
+    if (size == 0)
+        return NULL;
+    if (MMAP_THRESHOLD && size >= MMAP_THRESHOLD)
+        return map_block(size);
+
+#if THREADS
+    /* The thread cache is tried before taking the arena lock */
+    tcache_t *tc = thread_cache();
+    if ((bp = tcache_get(tc, size)) != NULL)
+        return bp;
+    arena_t *a = tc->arena;
+#else
+    arena_t *a = &arenas[0];
+#endif
+
+    LOCK(a);
+#if THREADS
+    remote_drain(a);
+#endif
+    bp = arena_malloc(a, size);
+    UNLOCK(a);
+    return bp;
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes.
+ *     Blocks carved from fresh heap memory are not cleared again.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+    int zeroed;
+
+    /* Ignore spurious requests, and refuse ones whose size overflows */
+    if (nmemb == 0 || size == 0 || nmemb > (size_t)-1 / size)
+        return NULL;
+    size *= nmemb;
+
+    /* A new mapping is zero already */
+    if (MMAP_THRESHOLD && size >= MMAP_THRESHOLD)
+        return map_block(size);
+
+#if THREADS
+    tcache_t *tc = thread_cache();
+    if ((bp = tcache_get(tc, size)) != NULL)
+        return memset(bp, 0, size);
+    arena_t *a = tc->arena;
+#else
+    arena_t *a = &arenas[0];
+#endif
+
+    LOCK(a);
+#if THREADS
+    remote_drain(a);
+#endif
+    bp = arena_calloc(a, size, &zeroed);
+    UNLOCK(a);
+
+    /* Clear outside the lock */
+    if (bp != NULL && !zeroed)
+        memset(bp, 0, size);
+    return bp;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload address is a multiple of alignment, a power of two.
+ *     The free space in front of the aligned payload goes back to the free lists.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    void *bp;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    /* Every block is DSIZE aligned already */
+    if (alignment <= DSIZE)
+        return mm_malloc(size);
+    if (size == 0 || size > (size_t)-1 / 4 || alignment > (size_t)-1 / 4)
+        return NULL;
+
+#if THREADS
+    arena_t *a = thread_cache()->arena;
+#else
+    arena_t *a = &arenas[0];
+#endif
+
+    LOCK(a);
+#if THREADS
+    remote_drain(a);
+#endif
+    bp = alloc_aligned(a, alignment, ASIZE(size));
+    UNLOCK(a);
+    return bp;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc, the same as mm_memalign
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/*
+ * mm_posix_memalign - POSIX posix_memalign: stores the block in *memptr and returns 0 or an error number.
+ *     The alignment must also be a multiple of sizeof(void *).
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+        return EINVAL;
+    if ((bp = mm_memalign(alignment, size)) == NULL && size != 0)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out under one lock, carved from one free block
+ *     where possible. Returns the number of blocks allocated, fewer than n only if memory runs out.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t i = 0;
+
+    if (size == 0)
+        return 0;
+    if (MMAP_THRESHOLD && size >= MMAP_THRESHOLD)
+    {
+        for (; i < n && (out[i] = map_block(size)) != NULL; i++)
+            ;
+        return i;
+    }
+
+#if THREADS
+    tcache_t *tc = thread_cache();
+    while (i < n && (out[i] = tcache_get(tc, size)) != NULL)
+        i++;
+    if (i == n)
+        return n;
+    arena_t *a = tc->arena;
+#else
+    arena_t *a = &arenas[0];
+#endif
+
+    LOCK(a);
+#if THREADS
+    remote_drain(a);
+#endif
+    i += arena_malloc_batch(a, size, n - i, out + i);
+    UNLOCK(a);
+    return i;
+}
+
+/*
+ * mm_free_batch - Free n blocks, taking each arena lock once per run of FREE_RUN blocks. Each run is
+ *     sorted by address in a copy, so that neighbours are merged before they reach the free lists
+ *     and ptrs is left as it was.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    void *run[FREE_RUN];
+
+    for (size_t k = 0; k < n; k += FREE_RUN)
+    {
+        size_t m = MIN(n - k, FREE_RUN);
+        memcpy(run, ptrs + k, m * sizeof(void *));
+        sort_ptrs(run, m);
+        free_sorted(run, m);
+    }
+}
+
+/*
+ * free_sorted - free n blocks sorted by address, a run of those of each arena at a time
+ */
+static void free_sorted(void **ptrs, size_t n)
+{
+    size_t i = 0;
+
+    while (i < n && ptrs[i] == NULL)
+        i++;
+
+    /* The blocks of an arena are consecutive in address order */
+    while (i < n)
+    {
+        arena_t *a = arena_of(ptrs[i]);
+        size_t j = i + 1;
+        while (j < n && arena_of(ptrs[j]) == a)
+            j++;
+
+        if (a == NULL)
+        {
+            for (; i < j; i++)
+                unmap_block(ptrs[i]);
+            continue;
+        }
+#if THREADS
+        if (a != thread_cache()->arena)
+        {
+            for (; i < j; i++)
+                remote_push(a, ptrs[i]);
+            continue;
+        }
+#endif
+        LOCK(a);
+        arena_free_batch(a, ptrs + i, j - i);
+        UNLOCK(a);
+        i = j;
+    }
+}
+
+/*
+ * mm_free - Free a block, reading its size from the header.
+ */
+void mm_free(void *ptr)
+{
+    mm_free_sized(ptr, 0);
+}
+
+/*
+ * mm_free_sized - Free a block whose size the caller knows: any size from the one requested
+ *     up to mm_malloc_usable_size, or 0 if unknown. Small blocks are then cached without reading their header.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+
+    size_t asize = size != 0 ? ASIZE(size) : 0;
+
+    arena_t *a = arena_of(ptr);
+    if (a == NULL)
+    {
+        unmap_block(ptr);
+        return;
+    }
+#if THREADS
+    /* Blocks of other arenas go to their remote stack, ours to the thread cache if there is room */
+    tcache_t *tc = thread_cache();
+    if (a != tc->arena)
+    {
+        remote_push(a, ptr);
+        return;
+    }
+    if (tcache_put(tc, ptr, asize))
+        return;
+#endif
+
+    LOCK(a);
+    arena_free(a, ptr, asize);
+    UNLOCK(a);
+}
+
+/*
+ * mm_malloc_usable_size - bytes of the block at ptr that the caller may use, at least the size it asked for
+ */
+size_t mm_malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    return usable_size(arena_of(ptr), ptr);
+}
+
+/*
+ * mm_realloc - Resize a block, keeping its contents up to the smaller size.
+ *     A heap block is resized in place where it can, shrinking or growing
+ *     into a free neighbour on either side or into new heap space at the top;
+ *     a mapped block is remapped. Otherwise the contents are copied into a new
+ *     block, which gets the slack of grow_size with -DREALLOC_SLACK=1.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return mm_malloc(size);
+    if (size == 0)
+    {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    arena_t *a = arena_of(ptr);
+    size_t gsize = size;
+    void *newptr = NULL;
+
+    /* A direct-mapped block stays mapped while it is large, and a heap block that gets large moves to a mapping */
+    if (a == NULL && MMAP_THRESHOLD && size >= MMAP_THRESHOLD)
+    {
+        STAT_SHARED(realloc_in_place);
+        return remap_block(ptr, size);
+    }
+    if (a != NULL && !(MMAP_THRESHOLD && size >= MMAP_THRESHOLD))
+    {
+        LOCK(a);
+        gsize = grow_size(a, ptr, size);
+        newptr = resize_block(a, ptr, size);
+        UNLOCK(a);
+        if (newptr != NULL)
+        {
+            STAT_SHARED(realloc_in_place);
+            return newptr;
+        }
+    }
+
+    /* The copy gets the slack too, but not at the cost of failing */
+    size_t old_size = usable_size(a, ptr);
+    if ((newptr = mm_malloc(gsize)) == NULL && (newptr = mm_malloc(size)) == NULL)
+        return NULL;
+    if (size > old_size)
+        mark_grown(newptr);
+
+    STAT_SHARED(realloc_copies);
+    memcpy(newptr, ptr, size < old_size ? size : old_size);
+    mm_free(ptr);
+    return newptr;
+}
+
+/*
+ * mm_lock_stats - lock counters of arena i of a THREADS build. Returns -1 if there is no such arena.
+ */
+int mm_lock_stats(int i, struct mm_lock_stats *stats)
+{
+#if THREADS
+    if (i < 0 || (size_t)i >= __atomic_load_n(&narenas, __ATOMIC_ACQUIRE))
+        return -1;
+
+    arena_t *a = &arenas[i];
+    pthread_mutex_lock(&a->lock);
+    stats->acquired = a->locks;
+    stats->contended = a->contended;
+    stats->remote_frees = a->remote_frees;
+    pthread_mutex_unlock(&a->lock);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * mm_ctx_create - Make an independent heap reserving size bytes, or as many as the default heap if size is 0.
+ *     Returns NULL if out of memory.
+ */
+mm_ctx_t *mm_ctx_create(size_t size)
+{
+    mm_ctx_t *ctx = malloc(sizeof(mm_ctx_t));
+
+    if (ctx == NULL)
+        return NULL;
+    ctx->skip = NULL;
+    ctx->slab_map = NULL;
+    if ((ctx->region = mem_region_create(size != 0 ? size : mem_region_maxsize(mem_default_region()))) == NULL)
+    {
+        free(ctx);
+        return NULL;
+    }
+#if THREADS
+    pthread_mutex_init(&ctx->lock, NULL);
+#endif
+    if (arena_init(ctx) < 0)
+    {
+        mm_ctx_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/*
+ * mm_ctx_destroy - Discard a heap and every block in it at once
+ */
+void mm_ctx_destroy(mm_ctx_t *ctx)
+{
+#if THREADS
+    pthread_mutex_destroy(&ctx->lock);
+#endif
+    mem_region_destroy(ctx->region);
+    free(ctx->skip);
+    free(ctx->slab_map);
+    free(ctx);
+}
+
+/*
+ * mm_ctx_reset - Free every block of a heap at once, leaving it as mm_ctx_create made it
+ */
+int mm_ctx_reset(mm_ctx_t *ctx)
+{
+    if (ctx == NULL)
+        return mm_init();
+
+    LOCK(ctx);
+    mem_region_reset_brk(ctx->region);
+    int ret = arena_init(ctx);
+    UNLOCK(ctx);
+    return ret;
+}
+
+/*
+ * mm_ctx_malloc - mm_malloc on a heap. Large requests come from the heap too, never from a mapping.
+ */
+void *mm_ctx_malloc(mm_ctx_t *ctx, size_t size)
+{
+    void *bp;
+
+    if (ctx == NULL)
+        return mm_malloc(size);
+    if (size == 0 || size > LINK_RANGE)
+        return NULL;
+
+    LOCK(ctx);
+    bp = arena_malloc(ctx, size);
+    UNLOCK(ctx);
+    return bp;
+}
+
+/*
+ * mm_ctx_calloc - mm_calloc on a heap
+ */
+void *mm_ctx_calloc(mm_ctx_t *ctx, size_t nmemb, size_t size)
+{
+    void *bp;
+    int zeroed;
+
+    if (ctx == NULL)
+        return mm_calloc(nmemb, size);
+    if (nmemb == 0 || size == 0 || nmemb > LINK_RANGE / size)
+        return NULL;
+    size *= nmemb;
+
+    LOCK(ctx);
+    bp = arena_calloc(ctx, size, &zeroed);
+    UNLOCK(ctx);
+
+    if (bp != NULL && !zeroed)
+        memset(bp, 0, size);
+    return bp;
+}
+
+/*
+ * mm_ctx_realloc - mm_realloc on a heap. A block that cannot be resized where it is moves within the heap.
+ */
+void *mm_ctx_realloc(mm_ctx_t *ctx, void *ptr, size_t size)
+{
+    void *newptr;
+
+    if (ctx == NULL)
+        return mm_realloc(ptr, size);
+    if (ptr == NULL)
+        return mm_ctx_malloc(ctx, size);
+    if (size == 0)
+    {
+        mm_ctx_free(ctx, ptr);
+        return NULL;
+    }
+    if (size > LINK_RANGE)
+        return NULL;
+
+    LOCK(ctx);
+    size_t gsize = grow_size(ctx, ptr, size);
+    if ((newptr = resize_block(ctx, ptr, size)) != NULL)
+        STAT_INC(ctx, realloc_in_place);
+    else
+    {
+        size_t old_size = usable_size(ctx, ptr);
+        if ((newptr = arena_malloc(ctx, gsize)) != NULL || (newptr = arena_malloc(ctx, size)) != NULL)
+        {
+            STAT_INC(ctx, realloc_copies);
+            if (REALLOC_SLACK && size > old_size && !(SLAB && is_slab(ctx, newptr)))
+                SET_GROWN(HDRP(newptr));
+            memcpy(newptr, ptr, MIN(size, old_size));
+            arena_free(ctx, ptr, 0);
+        }
+    }
+    UNLOCK(ctx);
+    return newptr;
+}
+
+/*
+ * mm_ctx_free - mm_free on a heap
+ */
+void mm_ctx_free(mm_ctx_t *ctx, void *ptr)
+{
+    if (ctx == NULL)
+    {
+        mm_free(ptr);
+        return;
+    }
+    if (ptr == NULL)
+        return;
+
+    LOCK(ctx);
+    arena_free(ctx, ptr, 0);
+    UNLOCK(ctx);
+}
+
+/*
+ * heap_error - report a problem found by mm_checkheap and return -1
+ */
+static int heap_error(arena_t *a, void *bp, const char *msg)
+{
+    fprintf(stderr, "mm_checkheap: %s at %p (heap %p)\n", msg, bp, (void *)a->heap_base);
+    return -1;
+}
+
+/*
+ * class_marked - whether the class map says free_list[index] is non-empty
+ */
+static int class_marked(arena_t *a, size_t index)
+{
+#if TLSF
+    return (a->sl_map[index / SL_COUNT] >> (index % SL_COUNT)) & 1;
+#else
+    return (a->class_map >> index) & 1;
+#endif
+}
+
+/*
+ * in_heap - whether bp is an aligned block pointer between the prologue and the epilogue
+ */
+static int in_heap(arena_t *a, void *bp)
+{
+    return bp > a->heap_listp && bp < a->heap_end_ptr && (size_t)bp % DSIZE == 0;
+}
+
+/*
+ * check_ends - level 1: the prologue, the epilogue and the heads of the free and quick lists
+ */
+static int check_ends(arena_t *a)
+{
+    if (GET(HDRP(a->heap_listp)) != PACK(DSIZE, 1, 1))
+        return heap_error(a, a->heap_listp, "bad prologue header");
+    if (GET_SIZE(HDRP(a->heap_end_ptr)) != 0 || !GET_ALLOC(HDRP(a->heap_end_ptr)))
+        return heap_error(a, a->heap_end_ptr, "bad epilogue header");
+    if ((char *)a->heap_end_ptr != (char *)mem_region_hi(a->region) + 1)
+        return heap_error(a, a->heap_end_ptr, "epilogue is not at the end of the heap");
+
+#if TLSF
+    for (size_t f = 0; f < FL_COUNT; f++)
+        if (((a->fl_map >> f) & 1) != (a->sl_map[f] != 0))
+            return heap_error(a, NULL, "first-level map disagrees with the second-level map");
+#endif
+    for (size_t i = 0; i < CLASS_SIZE; i++)
+    {
+        void *bp = a->free_list[i];
+        if (class_marked(a, i) != (bp != NULL))
+            return heap_error(a, bp, "class map disagrees with the free list");
+        if (bp == NULL)
+            continue;
+        if (!in_heap(a, bp) || GET_ALLOC(HDRP(bp)))
+            return heap_error(a, bp, "free list head is not a free block");
+#if !TLSF
+        if (i == TREE_CLASS ? PARENT(bp) != NULL : PREV_PTR(a, bp) != NULL)
+#else
+        if (PREV_PTR(a, bp) != NULL)
+#endif
+            return heap_error(a, bp, "free list head has a predecessor");
+    }
+    for (size_t bin = 0; bin < QUICK_BINS; bin++)
+        if (((a->quick_map >> bin) & 1) != (a->quick_list[bin] != NULL) || a->quick_count[bin] > QUICK_COUNT)
+            return heap_error(a, a->quick_list[bin], "quick map or count disagrees with the quick list");
+    return 0;
+}
+
+/*
+ * check_blocks - level 2: walk the heap, checking each block against its neighbours.
+ *     Stores the number of free blocks in *nfree.
+ */
+static int check_blocks(arena_t *a, size_t *nfree)
+{
+    size_t prev_alloc = 1, prev_free = 0;
+    void *bp;
+
+    *nfree = 0;
+    for (bp = NEXT_BLKP(a->heap_listp); bp < a->heap_end_ptr; bp = NEXT_BLKP(bp))
+    {
+        size_t size = GET_SIZE(HDRP(bp));
+        if ((size_t)bp % DSIZE != 0 || size < MIN_BLOCK || size % DSIZE != 0 ||
+            size > (size_t)((char *)a->heap_end_ptr - (char *)bp))
+            return heap_error(a, bp, "bad block size or alignment");
+        if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+            return heap_error(a, bp, "prev_alloc bit disagrees with the previous block");
+        prev_alloc = GET_ALLOC(HDRP(bp));
+        if (prev_alloc)
+        {
+            prev_free = 0;
+            continue;
+        }
+        if (GET(HDRP(bp)) != GET(FTRP(bp)))
+            return heap_error(a, bp, "header and footer differ");
+        if (prev_free)
+            return heap_error(a, bp, "two free blocks next to each other");
+        prev_free = 1;
+        (*nfree)++;
+    }
+    if (bp != a->heap_end_ptr)
+        return heap_error(a, bp, "last block runs past the epilogue");
+    if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+        return heap_error(a, bp, "epilogue prev_alloc bit disagrees with the last block");
+    return 0;
+}
+
+/*
+ * check_free - whether bp is a free block of class index in the heap
+ */
+static int check_free(arena_t *a, void *bp, size_t index)
+{
+    if (!in_heap(a, bp) || GET_ALLOC(HDRP(bp)))
+        return heap_error(a, bp, "free list holds a block that is not free");
+    if (class_index(GET_SIZE(HDRP(bp))) != index)
+        return heap_error(a, bp, "free list holds a block of another class");
+    return 0;
+}
+
+#if !TLSF
+/*
+ * check_tree - check the red-black subtree at bp, whose nodes must order between lo and hi (NULL for no bound).
+ *     Returns its black height, or -1. Counts its nodes into *count.
+ */
+static int check_tree(arena_t *a, void *bp, void *parent, void *lo, void *hi, size_t *count)
+{
+    if (bp == NULL)
+        return 1;
+    if (check_free(a, bp, TREE_CLASS) < 0)
+        return -1;
+    if (PARENT(bp) != parent)
+        return heap_error(a, bp, "tree node has a wrong parent");
+    if ((lo != NULL && !NODE_LESS(lo, bp)) || (hi != NULL && !NODE_LESS(bp, hi)))
+        return heap_error(a, bp, "tree node out of order");
+    if (IS_RED(bp) && (IS_RED(LEFT(bp)) || IS_RED(RIGHT(bp))))
+        return heap_error(a, bp, "red tree node has a red child");
+    (*count)++;
+
+    int left = check_tree(a, LEFT(bp), bp, lo, bp, count);
+    int right = check_tree(a, RIGHT(bp), bp, bp, hi, count);
+    if (left < 0 || right < 0)
+        return -1;
+    if (left != right)
+        return heap_error(a, bp, "tree paths have different black heights");
+    return left + !IS_RED(bp);
+}
+#endif
+
+/*
+ * check_lists - level 3: every free block is on the list or tree of its class, and the
+ *     quick lists and slab lists hold what they should
+ */
+static int check_lists(arena_t *a, size_t nfree)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < CLASS_SIZE; i++)
+    {
+#if !TLSF
+        if (i == TREE_CLASS)
+        {
+            if (IS_RED(a->free_list[i]))
+                return heap_error(a, a->free_list[i], "tree root is red");
+            if (check_tree(a, a->free_list[i], NULL, NULL, NULL, &count) < 0)
+                return -1;
+            continue;
+        }
+#endif
+        void *prev = NULL;
+        for (void *bp = a->free_list[i]; bp != NULL; prev = bp, bp = NEXT_PTR(a, bp))
+        {
+            if (check_free(a, bp, i) < 0)
+                return -1;
+            if (PREV_PTR(a, bp) != prev)
+                return heap_error(a, bp, "free list links disagree");
+            if (++count > nfree)
+                return heap_error(a, bp, "free lists hold more blocks than the heap");
+            if (a->skip != NULL && prev != NULL && prev >= bp)
+                return heap_error(a, bp, "ordered free list out of address order");
+            if (a->skip != NULL && (prev == NULL || SKIP_CHUNK(a, prev) != SKIP_CHUNK(a, bp)) &&
+                FROM_LINK(a, a->skip->head[i][SKIP_CHUNK(a, bp)]) != bp)
+                return heap_error(a, bp, "lowest block of a chunk not marked");
+        }
+        if (a->skip != NULL && a->skip->tail[i] != prev)
+            return heap_error(a, prev, "ordered free list tail is wrong");
+    }
+    if (a->skip != NULL)
+        for (size_t i = 0; i < CLASS_SIZE; i++)
+            for (size_t c = 0; c < SKIP_CHUNKS; c++)
+            {
+                void *head = FROM_LINK(a, a->skip->head[i][c]);
+                int marked = (a->skip->map[i][c / SKIP_WORD] >> (c % SKIP_WORD)) & 1;
+                if ((head != NULL) != marked || (head != NULL && (GET_ALLOC(HDRP(head)) || SKIP_CHUNK(a, head) != c)))
+                    return heap_error(a, head, "chunk mark of an ordered list is wrong");
+            }
+    if (count != nfree)
+        return heap_error(a, NULL, "free blocks missing from the free lists");
+
+    for (size_t bin = 0; bin < QUICK_BINS; bin++)
+    {
+        size_t n = 0;
+        for (void *bp = a->quick_list[bin]; bp != NULL; bp = *(void **)bp)
+            if (!in_heap(a, bp) || !GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) < MIN_BLOCK + bin * DSIZE ||
+                ++n > a->quick_count[bin])
+                return heap_error(a, bp, "quick list holds a wrong block");
+        if (n != a->quick_count[bin])
+            return heap_error(a, a->quick_list[bin], "quick count disagrees with the quick list");
+    }
+
+    for (size_t i = 0; i < SLAB_CLASSES; i++)
+    {
+        slab_t *prev = NULL;
+        for (slab_t *sp = a->slab_list[i]; sp != NULL; prev = sp, sp = sp->next)
+            if (!is_slab(a, sp) || sp->size != (i + 1) * DSIZE || sp->used >= sp->capacity || sp->prev != prev)
+                return heap_error(a, sp, "slab list holds a wrong slab");
+    }
+    return 0;
+}
+
+/*
+ * check_arena - run the checks of levels up to level on an arena
+ */
+static int check_arena(arena_t *a, int level)
+{
+    size_t nfree;
+
+    if (check_ends(a) < 0)
+        return -1;
+    if (level >= 2 && check_blocks(a, &nfree) < 0)
+        return -1;
+    if (level >= 3 && check_lists(a, nfree) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * mm_checkheap - Check the default heap, every arena of it in a THREADS build, up to level 1, 2 or 3
+ */
+int mm_checkheap(int level)
+{
+#if THREADS
+    size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+#else
+    size_t n = 1;
+#endif
+
+    for (size_t i = 0; i < n; i++)
+        if (mm_ctx_checkheap(&arenas[i], level) < 0)
+            return -1;
+    return 0;
+}
+
+/*
+ * mm_ctx_checkheap - Check a heap up to level 1, 2 or 3
+ */
+int mm_ctx_checkheap(mm_ctx_t *ctx, int level)
+{
+    if (ctx == NULL)
+        return mm_checkheap(level);
+
+    LOCK(ctx);
+    int ret = check_arena(ctx, level);
+    UNLOCK(ctx);
+    return ret;
+}
+
+#if STATS
+/*
+ * add_counters - add the counters of from to to
+ */
+static void add_counters(struct mm_counters *to, const struct mm_counters *from)
+{
+    to->fit_calls += from->fit_calls;
+    to->fit_probes += from->fit_probes;
+    to->splits += from->splits;
+    to->coalesces += from->coalesces;
+    to->extends += from->extends;
+    to->extend_bytes += from->extend_bytes;
+    to->realloc_in_place += from->realloc_in_place;
+    to->realloc_copies += from->realloc_copies;
+}
+#endif
+
+/*
+ * arena_stats - add the counters and free space of an arena to stats
+ */
+static void arena_stats(arena_t *a, struct mm_stats *stats)
+{
+#if STATS
+    add_counters(&stats->counters, &a->stats);
+#endif
+    for (void *bp = NEXT_BLKP(a->heap_listp); bp < a->heap_end_ptr; bp = NEXT_BLKP(bp))
+    {
+        size_t size = GET_SIZE(HDRP(bp));
+        if (GET_ALLOC(HDRP(bp)))
+            continue;
+        size_t i = MIN(MSB(size - 1) + 1, MM_STATS_CLASSES - 1);
+        stats->free_blocks[i]++;
+        stats->free_bytes[i] += size;
+        stats->total_free += size;
+        stats->largest_free = MAX(stats->largest_free, size);
+    }
+    for (size_t bin = 0; bin < QUICK_BINS; bin++)
+        for (void *bp = a->quick_list[bin]; bp != NULL; bp = *(void **)bp)
+        {
+            stats->quick_blocks++;
+            stats->quick_bytes += GET_SIZE(HDRP(bp));
+        }
+}
+
+/*
+ * mm_stats - Report the counters and free space of the default heap, over all its arenas
+ */
+void mm_stats(struct mm_stats *stats)
+{
+#if THREADS
+    size_t n = __atomic_load_n(&narenas, __ATOMIC_ACQUIRE);
+#else
+    size_t n = 1;
+#endif
+
+    memset(stats, 0, sizeof(*stats));
+#if STATS
+    add_counters(&stats->counters, &shared_stats);
+#endif
+    for (size_t i = 0; i < n; i++)
+    {
+        LOCK(&arenas[i]);
+        arena_stats(&arenas[i], stats);
+        UNLOCK(&arenas[i]);
+    }
+    if (stats->total_free != 0)
+        stats->fragmentation = 1.0 - (double)stats->largest_free / stats->total_free;
+}
+
+/*
+ * mm_ctx_stats - Report the counters and free space of a heap
+ */
+void mm_ctx_stats(mm_ctx_t *ctx, struct mm_stats *stats)
+{
+    if (ctx == NULL)
+    {
+        mm_stats(stats);
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    LOCK(ctx);
+    arena_stats(ctx, stats);
+    UNLOCK(ctx);
+    if (stats->total_free != 0)
+        stats->fragmentation = 1.0 - (double)stats->largest_free / stats->total_free;
+}
+
+/*
+ * mm_arena_create - Make a bump allocator taking chunks of chunk_size bytes, or BUMP_CHUNK if 0, from a heap.
+ *     The first chunk is only taken by the first allocation. Returns NULL if out of memory.
+ */
+mm_arena_t *mm_arena_create(mm_ctx_t *ctx, size_t chunk_size)
+{
+    mm_arena_t *arena = mm_ctx_malloc(ctx, sizeof(mm_arena_t));
+
+    if (arena == NULL)
+        return NULL;
+    arena->ctx = ctx;
+    arena->chunk_size = chunk_size != 0 ? ALIGN(chunk_size) : BUMP_CHUNK;
+    arena->first = arena->cur = NULL;
+    arena->ptr = arena->end = NULL;
+    return arena;
+}
+
+/*
+ * bump_refill - carve size bytes from the chunk after the current one, taking a new chunk from the heap
+ *     if there is none or it is too small
+ */
+static void *bump_refill(mm_arena_t *arena, size_t size)
+{
+    bump_chunk_t *c = arena->cur != NULL ? arena->cur->next : arena->first;
+
+    if (c == NULL || (size_t)(c->end - BUMP_PAYLOAD(c)) < size)
+    {
+        /* A new chunk goes right after the current one, so that the chunks after it are still used in turn */
+        size_t payload = MAX(arena->chunk_size, size);
+        if (payload > SIZE_MAX - BUMP_HDR)
+            return NULL;
+        bump_chunk_t *fresh = mm_ctx_malloc(arena->ctx, BUMP_HDR + payload);
+        if (fresh == NULL)
+            return NULL;
+        fresh->end = BUMP_PAYLOAD(fresh) + payload;
+        fresh->next = c;
+        if (arena->cur != NULL)
+            arena->cur->next = fresh;
+        else
+            arena->first = fresh;
+        c = fresh;
+    }
+
+    arena->cur = c;
+    arena->ptr = BUMP_PAYLOAD(c) + size;
+    arena->end = c->end;
+    return BUMP_PAYLOAD(c);
+}
+
+/*
+ * mm_arena_alloc - Allocate size bytes, aligned like mm_malloc, by bumping a pointer. Returns NULL if size is 0
+ *     or out of memory.
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size)
+{
+    if (size == 0 || size > SIZE_MAX - DSIZE)
+        return NULL;
+    size = ALIGN(size);
+    if (size <= (size_t)(arena->end - arena->ptr))
+    {
+        void *p = arena->ptr;
+        arena->ptr += size;
+        return p;
+    }
+    return bump_refill(arena, size);
+}
+
+/*
+ * mm_arena_reset - Drop every block of a bump allocator at once. Its chunks are kept and carved again in order.
+ */
+void mm_arena_reset(mm_arena_t *arena)
+{
+    arena->cur = NULL;
+    arena->ptr = arena->end = NULL;
+}
+
+/*
+ * mm_arena_destroy - Return the chunks of a bump allocator and the allocator itself to their heap
+ */
+void mm_arena_destroy(mm_arena_t *arena)
+{
+    bump_chunk_t *c = arena->first;
+
+    while (c != NULL)
+    {
+        bump_chunk_t *next = c->next;
+        mm_ctx_free(arena->ctx, c);
+        c = next;
+    }
+    mm_ctx_free(arena->ctx, arena);
+}
@@ -3,7 +3,78 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
+extern size_t mm_malloc_usable_size(void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern int mm_set_fit(const char *policy);
+extern void mm_set_ordered(int ordered);
+
+/* Independent heaps, each with its own free lists and memlib region. A NULL context is the
+   default heap of the calls above. Blocks go back through the context they came from */
+typedef struct mm_ctx mm_ctx_t;
+extern mm_ctx_t *mm_ctx_create(size_t size);
+extern void mm_ctx_destroy(mm_ctx_t *ctx);
+extern int mm_ctx_reset(mm_ctx_t *ctx);
+extern void *mm_ctx_malloc(mm_ctx_t *ctx, size_t size);
+extern void *mm_ctx_calloc(mm_ctx_t *ctx, size_t nmemb, size_t size);
+extern void *mm_ctx_realloc(mm_ctx_t *ctx, void *ptr, size_t size);
+extern void mm_ctx_free(mm_ctx_t *ctx, void *ptr);
+
+/* Bump allocators over chunks taken from a heap (NULL for the default one), for blocks that die
+   together. Their blocks are never freed one by one: mm_arena_reset drops them all in O(1) and keeps
+   the chunks for reuse, mm_arena_destroy returns the chunks to the heap. Not safe to share across threads */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(mm_ctx_t *ctx, size_t chunk_size);
+extern void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
+/* Heap consistency checks, returning 0 or -1 after printing the first problem found.
+   Level 1 checks the heap ends and list heads in O(1), level 2 walks every block,
+   level 3 also walks every free list, the tree, the quick lists and the slab lists */
+extern int mm_checkheap(int level);
+extern int mm_ctx_checkheap(mm_ctx_t *ctx, int level);
+
+/* Event counters of a STATS=1 build, all zero otherwise */
+struct mm_counters {
+    unsigned long fit_calls;        /* free list searches */
+    unsigned long fit_probes;       /* free blocks and tree nodes those searches looked at */
+    unsigned long splits;           /* free blocks split to place a smaller block */
+    unsigned long coalesces;        /* frees and heap extensions that merged free neighbours */
+    unsigned long extends;          /* heap extensions */
+    size_t extend_bytes;            /* bytes they added */
+    unsigned long realloc_in_place; /* reallocs that resized the block where it was, or remapped it */
+    unsigned long realloc_copies;   /* reallocs that copied the block */
+};
+
+/* Free space of a heap, with its counters since mm_init or mm_ctx_create */
+#define MM_STATS_CLASSES 32
+struct mm_stats {
+    struct mm_counters counters;
+    unsigned long free_blocks[MM_STATS_CLASSES]; /* free blocks of 2^(i-1)+1 to 2^i bytes, larger ones in the last class */
+    size_t free_bytes[MM_STATS_CLASSES];
+    unsigned long quick_blocks; /* freed blocks waiting on the quick lists, not counted above */
+    size_t quick_bytes;
+    size_t total_free;    /* bytes in free blocks */
+    size_t largest_free;  /* bytes in the largest free block */
+    double fragmentation; /* external fragmentation, 1 - largest_free / total_free (0 without free space) */
+};
+extern void mm_stats(struct mm_stats *stats);
+extern void mm_ctx_stats(mm_ctx_t *ctx, struct mm_stats *stats);
+
+/* Lock counters of one arena of a thread-safe (THREADS=1) build */
+struct mm_lock_stats {
+    unsigned long acquired;     /* arena lock acquisitions */
+    unsigned long contended;    /* acquisitions that had to wait for another thread */
+    unsigned long remote_frees; /* blocks freed by other threads, taken from the remote stack */
+};
+extern int mm_lock_stats(int arena, struct mm_lock_stats *stats);
 
 
 /* 
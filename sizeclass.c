@@ -0,0 +1,273 @@
+/*
+ * sizeclass.c - Size-class table generator for mm.c
+ *
+ * Reads trace files in the format of mdriver's read_trace, counts the
+ * block sizes that their malloc, realloc and calloc requests need, and
+ * writes classes.h: a table mapping each block size up to
+ * CLASS_TABLE_MAX bytes to a free-list class. The most requested block
+ * sizes get exact classes of their own. The remaining sizes share
+ * power-of-two classes, which are merged where traffic is light to
+ * stay within mm.c's class budget. Build mm.c with -DCLASS_TABLE=1 to
+ * use the table.
+ *
+ * Usage: sizeclass [-h] [-p <percent>] [-s] <tracefile>... > classes.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "sizeclass.h"
+
+#define MAXLINE 1024
+#define MAX_UNITS (CLASS_TABLE_MAX / 8 + 1)
+
+/* The block layout of one word size */
+typedef struct
+{
+	char *guard; /* preprocessor condition selecting it, NULL for the #else branch */
+	int wsize;
+	int dsize;
+} abi_t;
+
+static abi_t abis[] = {{"defined(__LP64__)", 8, 16}, {NULL, 4, 8}};
+
+static unsigned long requests[CLASS_TABLE_MAX + 1]; /* requests of each size that may get a table class */
+static unsigned long total;													/* all requests counted in requests[] */
+
+static void read_sizes(char *filename, int with_slab);
+static void write_table(abi_t *abi, double percent);
+static unsigned long merged_load(unsigned long *blocks, char *bound, int u, int min_unit, int units);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+	double percent = 1.0; /* smallest share of the requests a hot size needs (-p) */
+	int with_slab = 0;		/* if set, count requests of up to SLAB_MAX bytes too (-s) */
+	int c, i;
+
+	while ((c = getopt(argc, argv, "p:sh")) != EOF)
+	{
+		switch (c)
+		{
+		case 'p':
+			percent = atof(optarg);
+			break;
+		case 's':
+			with_slab = 1;
+			break;
+		default:
+			usage();
+			exit(c == 'h' ? 0 : 1);
+		}
+	}
+	if (optind == argc)
+	{
+		usage();
+		exit(1);
+	}
+
+	for (i = optind; i < argc; i++)
+		read_sizes(argv[i], with_slab);
+
+	printf("/*\n * classes.h - size classes for mm.c, generated by sizeclass from %d trace(s)\n",
+				 argc - optind);
+	printf(" *     with %lu requests of up to %d bytes. Build mm.c with -DCLASS_TABLE=1 to use them.\n */\n\n",
+				 total, CLASS_TABLE_MAX);
+	for (i = 0; i < (int)(sizeof(abis) / sizeof(abis[0])); i++)
+		write_table(&abis[i], percent);
+	printf("#endif\n");
+	return 0;
+}
+
+/*
+ * read_sizes - count the request sizes of a trace file
+ */
+static void read_sizes(char *filename, int with_slab)
+{
+	FILE *tracefile;
+	char type[MAXLINE];
+	int header[4];
+	unsigned index, size;
+	int i;
+
+	if ((tracefile = fopen(filename, "r")) == NULL)
+	{
+		fprintf(stderr, "sizeclass: could not open %s\n", filename);
+		exit(1);
+	}
+	for (i = 0; i < 4; i++)
+		if (fscanf(tracefile, "%d", &header[i]) != 1)
+		{
+			fprintf(stderr, "sizeclass: bad header in %s\n", filename);
+			exit(1);
+		}
+
+	while (fscanf(tracefile, "%s", type) != EOF)
+	{
+		switch (type[0])
+		{
+		case 'a':
+		case 'r':
+		case 'c':
+			if (fscanf(tracefile, "%u %u", &index, &size) != 2)
+				break;
+			if (size > 0 && size <= CLASS_TABLE_MAX && (with_slab || size > SLAB_MAX))
+			{
+				requests[size]++;
+				total++;
+			}
+			break;
+		case 'f':
+			fscanf(tracefile, "%u", &index);
+			break;
+		case 'b': /* scope lines of mdriver -A */
+		case 'e':
+			break;
+		default:
+			fprintf(stderr, "sizeclass: bogus type character (%c) in %s\n", type[0], filename);
+			exit(1);
+		}
+	}
+	fclose(tracefile);
+}
+
+/*
+ * write_table - choose the classes of one block layout and print its table.
+ *     Classes are runs of block sizes, in units of dsize, ending at the bounds set in bound[].
+ */
+static void write_table(abi_t *abi, double percent)
+{
+	unsigned long blocks[MAX_UNITS] = {0}; /* requests needing each block size */
+	char bound[MAX_UNITS] = {0};					 /* a class ends at this block size */
+	char pinned[MAX_UNITS] = {0};					 /* the bound delimits an exact class */
+	char exact[MAX_UNITS] = {0};					 /* the block size has a class of its own */
+	int units = CLASS_TABLE_MAX / abi->dsize;
+	int min_unit = 2; /* mm.c's MIN_BLOCK is two double words */
+	int size, u, nbounds = 0;
+
+	for (size = 1; size <= CLASS_TABLE_MAX; size++)
+	{
+		u = (size + abi->wsize + abi->dsize - 1) / abi->dsize;
+		if (u < min_unit)
+			u = min_unit;
+		if (u <= units)
+			blocks[u] += requests[size];
+	}
+
+	/* Power-of-two classes to start with, as mm.c has without a table */
+	for (u = min_unit; u <= units; u *= 2)
+	{
+		bound[u] = 1;
+		nbounds++;
+	}
+	bound[units] = pinned[units] = 1;
+
+	/* Give the hottest block sizes exact classes while the budget allows, merging the
+	   lightest pair of coarse classes to make room */
+	for (;;)
+	{
+		int hot = 0;
+		for (u = min_unit; u <= units; u++)
+			if (!exact[u] && blocks[u] > blocks[hot])
+				hot = u;
+		if (hot == 0 || blocks[hot] < total * percent / 100.0)
+			break;
+
+		char saved_bound[MAX_UNITS];
+		int saved_nbounds = nbounds;
+		memcpy(saved_bound, bound, sizeof(bound));
+		exact[hot] = 1;
+		if (!bound[hot])
+		{
+			bound[hot] = 1;
+			nbounds++;
+		}
+		if (hot - 1 >= min_unit && !bound[hot - 1])
+		{
+			bound[hot - 1] = 1;
+			nbounds++;
+		}
+
+		while (nbounds > TABLE_CLASSES)
+		{
+			int best = 0;
+			unsigned long best_load = 0;
+			for (u = min_unit; u < units; u++)
+			{
+				if (!bound[u] || pinned[u] || u == hot || u == hot - 1)
+					continue;
+				unsigned long load = merged_load(blocks, bound, u, min_unit, units);
+				if (best == 0 || load < best_load)
+				{
+					best = u;
+					best_load = load;
+				}
+			}
+			if (best == 0)
+				break;
+			bound[best] = 0;
+			nbounds--;
+		}
+		if (nbounds > TABLE_CLASSES)
+		{
+			/* No room: this size keeps sharing a class, and so does every colder one */
+			memcpy(bound, saved_bound, sizeof(bound));
+			nbounds = saved_nbounds;
+			exact[hot] = 0;
+			break;
+		}
+		pinned[hot] = 1;
+		if (hot - 1 >= min_unit)
+			pinned[hot - 1] = 1;
+	}
+
+	if (abi->guard != NULL)
+		printf("#if %s\n", abi->guard);
+	else
+		printf("#else\n");
+	printf("/* block sizes with a class of their own:");
+	for (u = min_unit; u <= units; u++)
+		if (exact[u])
+			printf(" %d", u * abi->dsize);
+	printf(" */\n");
+	printf("static const unsigned char class_table[CLASS_TABLE_MAX / %d + 1] = {", abi->dsize);
+	int class = 0;
+	for (u = 0; u <= units; u++)
+	{
+		printf("%s%d,", u % 16 == 0 ? "\n    " : " ", class);
+		if (u >= min_unit && bound[u])
+			class++;
+	}
+	printf("\n};\n");
+}
+
+/*
+ * merged_load - requests falling in the class that removing bound u would leave,
+ *     which runs from the bound before u to the one after it
+ */
+static unsigned long merged_load(unsigned long *blocks, char *bound, int u, int min_unit, int units)
+{
+	unsigned long load = 0;
+	int lo = u, hi = u + 1;
+
+	while (lo > min_unit && !bound[lo - 1])
+		lo--;
+	while (hi < units && !bound[hi])
+		hi++;
+	for (; lo <= hi; lo++)
+		load += blocks[lo];
+	return load;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: sizeclass [-h] [-p <percent>] [-s] <tracefile>... > classes.h\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-h           Print this message.\n");
+	fprintf(stderr, "\t-p <percent> Share of the requests a block size needs for an exact class (default 1).\n");
+	fprintf(stderr, "\t-s           Count requests the slab tier serves too, for a SLAB=0 build.\n");
+}
@@ -0,0 +1,22 @@
+#ifndef __SIZECLASS_H_
+#define __SIZECLASS_H_
+
+/*
+ * sizeclass.h - Request size limits of mm.c's tiers, shared with the
+ *     sizeclass tool that generates its classes.h
+ */
+
+/* Largest block size whose class class_table gives with -DCLASS_TABLE=1 */
+#define CLASS_TABLE_MAX 4096
+
+/* Classes the table may use: those below the first power-of-two class above
+   CLASS_TABLE_MAX, which holds blocks of 2^12 + 1 to 2^13 bytes */
+#define TABLE_CLASSES 13
+
+/* Requests the slab tier serves, which never reach the free lists */
+#define SLAB_MAX 64
+
+/* Freed blocks kept on the quick lists, which malloc checks before the free lists */
+#define QUICK_MAX 512
+
+#endif